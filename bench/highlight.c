@@ -0,0 +1,151 @@
+// Microbenchmark for the syntax highlighter.
+//
+// Highlights every line of a file (or of a generated C-like source when no 
+// file is given) a few times over and reports the throughput in MB/s, both 
+// with the built-in C keywords and with a synthetic 200 keyword language.
+//
+// Usage: bench/highlight [file]
+
+#define main terminalEditorMain
+#include "../text-editor.c"
+#undef main
+
+#define BENCH_PASSES 5
+#define BENCH_GENERATED_LINES 400000
+#define BENCH_MANY_KEYWORDS 200
+
+struct BenchLine {
+    char *text;
+    int len;
+};
+
+double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Splits `buf` into lines, in place.
+struct BenchLine *benchSplitLines(char *buf, size_t len, int *lineAmt) {
+    int capacity = 1024;
+    struct BenchLine *lines = malloc(sizeof(struct BenchLine) * capacity);
+    *lineAmt = 0;
+
+    size_t start = 0;
+    while (start < len) {
+        size_t end = findNewline(buf, start, len);
+        if (*lineAmt == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, sizeof(struct BenchLine) * capacity);
+        }
+        lines[*lineAmt].text = &buf[start];
+        lines[*lineAmt].len = end - start;
+        (*lineAmt)++;
+        start = end + 1;
+    }
+    return lines;
+}
+
+char *benchGenerateSource(size_t *len) {
+    struct AppendBuf aBuf = NEW_APPEND_BUF;
+    char line[160];
+
+    for (int i = 0; i < BENCH_GENERATED_LINES; ++i) {
+        int lineLen;
+        switch (i % 4) {
+            case 0:
+                lineLen = snprintf(line, sizeof(line), 
+                    "static unsigned int value_%d = compute(%d, buffer[%d]); // note\n", i, i, i % 97);
+                break;
+            case 1:
+                lineLen = snprintf(line, sizeof(line), 
+                    "    if (counter_%d > limit && flags != 0) { return process(\"item %d\"); }\n", i, i);
+                break;
+            case 2:
+                lineLen = snprintf(line, sizeof(line), 
+                    "    for (int j = 0; j < %d; ++j) { total += weights[j] * 3.5; } /* sum */\n", i);
+                break;
+            default:
+                lineLen = snprintf(line, sizeof(line), 
+                    "    struct record_%d *entry = lookup_table_entry(table, key_%d, &error);\n", i, i);
+                break;
+        }
+        bufAppend(&aBuf, line, lineLen);
+    }
+    *len = aBuf.len;
+    return aBuf.buf;
+}
+
+double benchHighlight(struct BenchLine *lines, int lineAmt, size_t bytes) {
+    int capacity = 0;
+    unsigned char *hl = NULL;
+    for (int i = 0; i < lineAmt; ++i) {
+        if (lines[i].len > capacity) {
+            capacity = lines[i].len;
+        }
+    }
+    hl = malloc(capacity + 1);
+
+    double start = benchNow();
+    for (int pass = 0; pass < BENCH_PASSES; ++pass) {
+        bool inComment = false;
+        for (int i = 0; i < lineAmt; ++i) {
+            inComment = editorHighlightText(lines[i].text, lines[i].len, hl, inComment);
+        }
+    }
+    double elapsed = benchNow() - start;
+
+    free(hl);
+    return (double)bytes * BENCH_PASSES / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char *argv[]) {
+    char *buf;
+    size_t len;
+
+    if (argc >= 2) {
+        FILE *fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+            perror("fopen");
+            return 1;
+        }
+        fseek(fp, 0, SEEK_END);
+        len = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        buf = malloc(len);
+        if (fread(buf, 1, len, fp) != len) {
+            perror("fread");
+            return 1;
+        }
+        fclose(fp);
+    }
+    else {
+        buf = benchGenerateSource(&len);
+    }
+
+    int lineAmt;
+    struct BenchLine *lines = benchSplitLines(buf, len, &lineAmt);
+    printf("%d lines, %.1f MB\n", lineAmt, len / (1024.0 * 1024.0));
+
+    editor.filename = "bench.c";
+    editorSelectSyntaxHighlight();
+    printf("c keywords:          %8.1f MB/s\n", benchHighlight(lines, lineAmt, len));
+
+    // A language with many keywords, none of which appear in the text.
+    static char *manyKeywords[BENCH_MANY_KEYWORDS + 1];
+    for (int i = 0; i < BENCH_MANY_KEYWORDS; ++i) {
+        char word[32];
+        snprintf(word, sizeof(word), (i % 2) ? "kw%dtype|" : "keyword%d", i);
+        manyKeywords[i] = strdup(word);
+    }
+    manyKeywords[BENCH_MANY_KEYWORDS] = NULL;
+
+    struct EditorSyntax manySyntax = highlightDb[0];
+    manySyntax.fileType = "many";
+    manySyntax.keywords = manyKeywords;
+    manySyntax.keywordTable = editorCompileKeywords(manyKeywords);
+    editor.syntax = &manySyntax;
+    printf("%d keywords:        %8.1f MB/s\n", BENCH_MANY_KEYWORDS, benchHighlight(lines, lineAmt, len));
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+// Memory benchmark for the rows of a loaded file.
+//
+// Opens a file (or a generated log when no file is given) both memory mapped
+// and through a pipe, and reports how many bytes each line takes: right after
+// loading, and once every row has been drawn, which renders and highlights
+// them. Heap blocks are counted with BENCH_MALLOC_OVERHEAD bytes of allocator
+// bookkeeping each.
+//
+// Usage: bench/memory [file]
+
+#define main terminalEditorMain
+#include "../text-editor.c"
+#undef main
+
+#include <sys/wait.h>
+
+#define BENCH_GENERATED_LINES 1000000
+#define BENCH_MALLOC_OVERHEAD 16
+
+// Bytes taken by the rows of the file, split into the tree holding the rows,
+// the heap blocks each row owns, and the file contents the rows point into.
+struct BenchMemory {
+    size_t tree;
+    size_t buffers;
+    size_t text;
+};
+
+size_t benchBlock(size_t size) {
+    return size + BENCH_MALLOC_OVERHEAD;
+}
+
+size_t benchNodeBytes(struct RowNode *node) {
+    size_t bytes = benchBlock(sizeof(struct RowNode));
+    for (int i = 0; i < node->childAmt; ++i) {
+        bytes += node->isBottom? benchBlock(sizeof(struct RowLeaf)) : benchNodeBytes(node->children[i].node);
+    }
+    return bytes;
+}
+
+struct BenchMemory benchMeasure() {
+    struct BenchMemory memory = { .tree = benchNodeBytes(editor.rowRoot) };
+
+    struct RowIter it = editorRowIterAt(0);
+    struct TextRow *row;
+    while ((row = editorRowIterNext(&it)) != NULL) {
+        if (row->charsMapped) {
+            memory.text += row->size + 1;
+        }
+        else {
+            memory.buffers += benchBlock(row->size + 1);
+        }
+        if (row->render != NULL) {
+            memory.buffers += benchBlock(row->renderSize + 1);
+        }
+        if (row->highlight != NULL) {
+            int spanAmt = 1;
+            while (row->highlight[spanAmt - 1].len != 0) {
+                spanAmt++;
+            }
+            memory.buffers += benchBlock(spanAmt * sizeof(struct HighlightSpan));
+        }
+    }
+    return memory;
+}
+
+void benchReport(const char *name, struct BenchMemory memory) {
+    double lines = editor.rowAmt;
+    printf("%-18s %8.1f %8.1f %8.1f %8.1f\n", name,
+        memory.tree / lines, memory.buffers / lines, memory.text / lines,
+        (memory.tree + memory.buffers + memory.text) / lines);
+}
+
+// Opens `path` into an empty editor, and reports on its rows before and
+// after they are all drawn.
+void benchOpen(const char *name, char *path) {
+    editor.rowRoot = rowTreeNew();
+    editor.rowAmt = 0;
+    editor.fileMap = NULL;
+    editor.fileMapSize = 0;
+
+    editorOpen(path);
+    editorFinishLoading();
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s, loaded", name);
+    benchReport(label, benchMeasure());
+
+    for (int fileRow = 0; fileRow < editor.rowAmt; ++fileRow) {
+        editorRowRendered(fileRow);
+    }
+    snprintf(label, sizeof(label), "%s, drawn", name);
+    benchReport(label, benchMeasure());
+}
+
+char *benchGenerateLog(size_t *len) {
+    struct AppendBuf aBuf = NEW_APPEND_BUF;
+    static const char *levels[] = { "INFO", "DEBUG", "WARN", "ERROR" };
+    char line[160];
+
+    for (int i = 0; i < BENCH_GENERATED_LINES; ++i) {
+        int lineLen = snprintf(line, sizeof(line),
+            "2024-05-%02d 12:%02d:%02d.%03d %s [worker-%d]%srequest id=%d took %d ms\n",
+            1 + i % 28, i / 60 % 60, i % 60, i % 1000, levels[i % 4], i % 16,
+            (i % 8 == 0)? "\t" : " ", i, i % 997);
+        bufAppend(&aBuf, line, lineLen);
+    }
+    *len = aBuf.len;
+    return aBuf.buf;
+}
+
+int main(int argc, char *argv[]) {
+    char path[] = "/tmp/bench-memory-XXXXXX";
+    char *file = argv[1];
+    size_t len;
+
+    if (argc < 2) {
+        int fd = mkstemp(path);
+        char *buf = benchGenerateLog(&len);
+        if (fd == -1 || write(fd, buf, len) != (ssize_t)len) {
+            perror("write");
+            return 1;
+        }
+        close(fd);
+        free(buf);
+        file = path;
+    }
+    else {
+        struct stat st;
+        if (stat(file, &st) == -1) {
+            perror("stat");
+            return 1;
+        }
+        len = st.st_size;
+    }
+
+    editor.undo = (struct UndoLog){ .text = NEW_APPEND_BUF };
+    editor.journal.fd = -1;
+
+    printf("bytes per line        tree  buffers     text    total\n");
+    benchOpen("mapped", file);
+    int lineAmt = editor.rowAmt;
+
+    // Feed the file through a pipe, which can't be memory mapped.
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        int fd = open(file, O_RDONLY);
+        char chunk[1 << 16];
+        ssize_t readLen;
+        while ((readLen = read(fd, chunk, sizeof(chunk))) > 0) {
+            if (write(fds[1], chunk, readLen) != readLen) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    char pipePath[64];
+    snprintf(pipePath, sizeof(pipePath), "/dev/fd/%d", fds[0]);
+
+    benchOpen("piped", pipePath);
+    waitpid(pid, NULL, 0);
+    printf("%d lines, %.1f MB\n", lineAmt, len / (1024.0 * 1024.0));
+
+    if (argc < 2) {
+        unlink(path);
+    }
+    return 0;
+}
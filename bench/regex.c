@@ -0,0 +1,212 @@
+// Microbenchmark for regular expression search.
+//
+// Finds every match of a few patterns in the lines of a log file (or of a 
+// generated log when no file is given) and reports the throughput in MB/s, 
+// next to the C library's POSIX regexec for reference. Then runs patterns 
+// that make backtracking matchers take exponential time against long lines 
+// of the same character, to show the matcher stays linear on them, and 
+// patterns whose longest match has to be followed to the end of the line 
+// from every position.
+//
+// Usage: bench/regex [file]
+
+#define main terminalEditorMain
+#include "../text-editor.c"
+#undef main
+
+#include <regex.h>
+
+#define BENCH_GENERATED_LINES 500000
+#define BENCH_PATHOLOGICAL_LINES 200
+#define BENCH_PATHOLOGICAL_LINE_LEN 2000
+
+struct BenchLine {
+    char *text;
+    int len;
+};
+
+double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Splits `buf` into NUL terminated lines, in place.
+struct BenchLine *benchSplitLines(char *buf, size_t len, int *lineAmt) {
+    int capacity = 1024;
+    struct BenchLine *lines = malloc(sizeof(struct BenchLine) * capacity);
+    *lineAmt = 0;
+
+    size_t start = 0;
+    while (start < len) {
+        size_t end = findNewline(buf, start, len);
+        if (*lineAmt == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, sizeof(struct BenchLine) * capacity);
+        }
+        lines[*lineAmt].text = &buf[start];
+        lines[*lineAmt].len = end - start;
+        if (end < len) {
+            buf[end] = '\0';
+        }
+        (*lineAmt)++;
+        start = end + 1;
+    }
+    return lines;
+}
+
+char *benchGenerateLog(size_t *len) {
+    static const char *levels[] = { "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char *paths[] = { "/api/users", "/api/orders", "/static/app.js", "/health" };
+    struct AppendBuf aBuf = NEW_APPEND_BUF;
+    char line[200];
+
+    for (int i = 0; i < BENCH_GENERATED_LINES; ++i) {
+        int lineLen = snprintf(line, sizeof(line), 
+            "2024-03-%02d 12:%02d:%02d.%03d [%s] worker-%d %s %s?id=%d user=%d status=%d took %dms\n",
+            1 + i % 28, i / 60 % 60, i % 60, i % 1000, levels[(i * 7) % 13 == 0 ? 3 : i % 3], 
+            i % 16, (i % 5 == 0)? "POST" : "GET", paths[i % 4], i, (i * 31) % 10007, 
+            (i % 97 == 0)? 503 : 200, (i * 13) % 900);
+        bufAppend(&aBuf, line, lineLen);
+    }
+    *len = aBuf.len;
+    return aBuf.buf;
+}
+
+// Returns the throughput of finding all the matches of `query` with the 
+// search modes in `flags`, and the amount of matches through `matchAmt`.
+double benchRegex(const char *query, int flags, struct BenchLine *lines, int lineAmt, size_t bytes, int *matchAmt) {
+    struct SearchPattern pattern;
+    searchCompile(&pattern, query, SEARCH_REGEX | flags);
+
+    struct SearchMatch *matches = NULL;
+    int capacity = 0;
+    *matchAmt = 0;
+
+    double start = benchNow();
+    for (int i = 0; i < lineAmt; ++i) {
+        struct TextRow row = { .chars = lines[i].text, .size = lines[i].len };
+        int amt = 0;
+        searchScanRow(&pattern, &row, i, &matches, &amt, &capacity);
+        *matchAmt += amt;
+    }
+    double elapsed = benchNow() - start;
+
+    free(matches);
+    searchFreePattern(&pattern);
+    return (double)bytes / elapsed / (1024 * 1024);
+}
+
+double benchRegexec(const char *query, struct BenchLine *lines, int lineAmt, size_t bytes, int *matchAmt) {
+    regex_t regex;
+    if (regcomp(&regex, query, REG_EXTENDED) != 0) {
+        return 0;
+    }
+    *matchAmt = 0;
+
+    double start = benchNow();
+    for (int i = 0; i < lineAmt; ++i) {
+        int at = 0;
+        regmatch_t match;
+        while (at < lines[i].len && regexec(&regex, &lines[i].text[at], 1, &match, (at > 0)? REG_NOTBOL : 0) == 0) {
+            if (match.rm_eo > match.rm_so) {
+                (*matchAmt)++;
+                at += match.rm_eo;
+            }
+            else {
+                at += match.rm_so + 1;
+            }
+        }
+    }
+    double elapsed = benchNow() - start;
+
+    regfree(&regex);
+    return (double)bytes / elapsed / (1024 * 1024);
+}
+
+void benchPatterns(const char **queries, struct BenchLine *lines, int lineAmt, size_t bytes) {
+    for (int i = 0; queries[i] != NULL; ++i) {
+        int matchAmt, regexecMatchAmt;
+        double speed = benchRegex(queries[i], 0, lines, lineAmt, bytes, &matchAmt);
+        double regexecSpeed = benchRegexec(queries[i], lines, lineAmt, bytes, &regexecMatchAmt);
+        printf("%-32s %8.1f MB/s %9d matches | regexec %8.1f MB/s %9d matches\n", 
+            queries[i], speed, matchAmt, regexecSpeed, regexecMatchAmt);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char *buf;
+    size_t len;
+
+    if (argc >= 2) {
+        FILE *fp = fopen(argv[1], "r");
+        if (fp == NULL) {
+            perror("fopen");
+            return 1;
+        }
+        fseek(fp, 0, SEEK_END);
+        len = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        buf = malloc(len);
+        if (fread(buf, 1, len, fp) != len) {
+            perror("fread");
+            return 1;
+        }
+        fclose(fp);
+    }
+    else {
+        buf = benchGenerateLog(&len);
+    }
+
+    int lineAmt;
+    struct BenchLine *lines = benchSplitLines(buf, len, &lineAmt);
+    printf("%d lines, %.1f MB\n", lineAmt, len / (1024.0 * 1024.0));
+
+    const char *queries[] = {
+        "ERROR",
+        "status=5[0-9][0-9]",
+        "(GET|POST) /api/[a-z]+",
+        "user=[0-9]+ status=200 took [0-9]+ms$",
+        "^2024-03-1[0-9] .*worker-1[0-5]",
+        NULL,
+    };
+    benchPatterns(queries, lines, lineAmt, len);
+
+    // Long lines of the same character, which no pattern below matches.
+    size_t pathologicalLen = BENCH_PATHOLOGICAL_LINES * (BENCH_PATHOLOGICAL_LINE_LEN + 1);
+    char *pathological = malloc(pathologicalLen);
+    memset(pathological, 'a', pathologicalLen);
+    for (int i = 0; i < BENCH_PATHOLOGICAL_LINES; ++i) {
+        pathological[i * (BENCH_PATHOLOGICAL_LINE_LEN + 1) + BENCH_PATHOLOGICAL_LINE_LEN] = '\n';
+    }
+    lines = benchSplitLines(pathological, pathologicalLen, &lineAmt);
+    printf("\n%d lines of %d times 'a'\n", lineAmt, BENCH_PATHOLOGICAL_LINE_LEN);
+
+    const char *pathologicalQueries[] = {
+        "(a|aa)*b",
+        "(a+)+b",
+        "(a*)*(a*)*b",
+        NULL,
+    };
+    benchPatterns(pathologicalQueries, lines, lineAmt, pathologicalLen);
+
+    // Every position begins a match here, but the longest one is only known 
+    // at the end of the line.
+    const char *longestQueries[] = {
+        "x*|.*yz",
+        "a|a.*z",
+        NULL,
+    };
+    benchPatterns(longestQueries, lines, lineAmt, pathologicalLen);
+
+    // With a 'b' at the end of each line, the a's before it never make a 
+    // whole word, wherever the match begins.
+    for (int i = 0; i < lineAmt; ++i) {
+        lines[i].text[lines[i].len - 1] = 'b';
+    }
+    int matchAmt;
+    double speed = benchRegex("a+", SEARCH_WHOLE_WORD, lines, lineAmt, pathologicalLen, &matchAmt);
+    printf("%-32s %8.1f MB/s %9d matches\n", "a+ (whole word, ending in b)", speed, matchAmt);
+
+    return 0;
+}
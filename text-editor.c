@@ -12,10 +12,23 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <time.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <poll.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /*
  * Defines.
@@ -29,6 +42,62 @@
 
 #define TERMINAL_EDITOR_QUIT_TIMES 3
 
+// Files at least this big are memory mapped instead of being read into slabs.
+#define TERMINAL_EDITOR_MMAP_MIN_SIZE (1 << 20)
+
+// Amount of bytes of the opened file that are loaded in between keypresses.
+#define TERMINAL_EDITOR_LOAD_CHUNK_SIZE (4 << 20)
+
+// Amount of buffers handed to each `writev` call when saving.
+#define TERMINAL_EDITOR_SAVE_IOV_MAX 1024
+
+// Size of the buffer that input is read into from the terminal.
+#define TERMINAL_EDITOR_INPUT_BUF_SIZE (64 << 10)
+
+// How long to wait for the rest of an escape sequence, or for the terminal 
+// to answer a query, in milliseconds.
+#define TERMINAL_EDITOR_ESC_TIMEOUT_MS 100
+
+// How often the journal of unsaved edits is synced to disk, in milliseconds.
+#define TERMINAL_EDITOR_JOURNAL_SYNC_MS 1000
+
+// Keys that are already queued up are applied without drawing a frame in 
+// between, for at most this many milliseconds, so the screen still keeps up 
+// with a long stream of keys.
+#define TERMINAL_EDITOR_FRAME_COALESCE_MS 50
+
+// Most frames drawn per second, or 0 to draw every frame right away. Can be 
+// set when building, i.e. with `-DTERMINAL_EDITOR_MAX_FPS=30` for slow links.
+#ifndef TERMINAL_EDITOR_MAX_FPS
+#define TERMINAL_EDITOR_MAX_FPS 0
+#endif
+
+// Rows at least this long are edited through a gap buffer, and are only 
+// rendered and highlighted around the part of them that is on screen.
+#define TERMINAL_EDITOR_LONG_ROW_SIZE (64 << 10)
+
+// Smallest gap a long row's gap buffer grows by.
+#define TERMINAL_EDITOR_GAP_MIN (4 << 10)
+
+// Long rows keep the highlighter's state about this many bytes apart, so 
+// highlighting can pick up from there.
+#define TERMINAL_EDITOR_HL_CHECKPOINT_SPACING 4096
+
+// Long rows with tabs keep the rendered column of every this many characters, 
+// so converting between character indices and columns only walks this far.
+#define TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING 4096
+
+// Amount of rows whose syntax state is caught up with in between keypresses.
+#define TERMINAL_EDITOR_SYNTAX_IDLE_ROWS 4096
+
+// Unchanged cells between two changed spans of a line are rewritten instead 
+// of being skipped over with a cursor move when there are fewer than this.
+#define TERMINAL_EDITOR_DAMAGE_GAP 8
+
+// Cell attribute flag for inverted colors. The rest of the attribute byte is 
+// an `EditorHighlight` value that determines the cell's color.
+#define CELL_INVERSE 0x80
+
 // Maps ASCII letters to their control character counterpart.
 // i.e. This maps 'a' (97) to 1 and 'z' (122) to 26.
 #define CTRL_KEY(k) ((k) & 0x1f)
@@ -44,6 +113,10 @@ enum EditorKey {
     END_KEY,
     PAGE_UP,
     PAGE_DOWN,
+
+    // Sent by the terminal around pasted text in bracketed paste mode.
+    PASTE_START,
+    PASTE_END,
 };
 
 enum EditorHighlight {
@@ -60,10 +133,51 @@ enum EditorHighlight {
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)
 #define HL_HIGHLIGHT_STRINGS (1 << 1)
 
+// Search modes.
+#define SEARCH_IGNORE_CASE (1 << 0)
+#define SEARCH_WHOLE_WORD (1 << 1)
+#define SEARCH_REGEX (1 << 2)
+
+// Amount of states a regular expression's DFAs can cache before starting 
+// over. Must be a power of two.
+#define TERMINAL_EDITOR_DFA_MAX_STATES 1024
+
+// Edits to a long row only rescan this many bytes on each side of them for 
+// regular expression matches. Longer matches across an edit are only found 
+// again when the query is searched anew.
+#define TERMINAL_EDITOR_SEARCH_REGEX_SPAN 4096
+
+// Buffers with more rows than this are scanned by a pool of worker threads, 
+// which take this many rows at a time.
+#define TERMINAL_EDITOR_SEARCH_CHUNK_ROWS 16384
+#define TERMINAL_EDITOR_SEARCH_MAX_THREADS 64
+
+// Most memory the undo log can take. The oldest undo steps are dropped to 
+// make room for new ones past this.
+#define TERMINAL_EDITOR_UNDO_MAX_BYTES (64 << 20)
+
 /*
  * Data.
  */
 
+// A syntax's keywords compiled into a perfect hash table, so that looking up 
+// a word costs the same no matter how many keywords the syntax has.
+struct KeywordEntry {
+    const char *word;
+    int len;
+    unsigned char highlight;
+};
+
+struct KeywordTable {
+    struct KeywordEntry *slots;
+    unsigned int mask;
+    unsigned int seed;
+
+    // Words outside of this length range are rejected without hashing them.
+    int minLen;
+    int maxLen;
+};
+
 struct EditorSyntax {
     char *fileType;
     char **fileMatch;
@@ -72,20 +186,475 @@ struct EditorSyntax {
     char *multiLineCommentStart;
     char *multilineCommentEnd;
     int flags;
+
+    // Built from `keywords` the first time the syntax is selected.
+    struct KeywordTable *keywordTable;
 };
 
-struct TextRow {
-    int idx;
+// State of the highlighter in between two tokens, all it needs to carry on 
+// highlighting from there.
+struct HighlightState {
+    bool inComment;
+    bool inLineComment;
+    bool inString;
+    char stringDelim;
+    bool prevWasSep;
+    bool prevWasNumber;
+};
+
+// A run of `len` rendered characters that are all highlighted as `type`. 
+// The highlighting of a row is a list of these, ended by one whose `len` is 
+// 0. Longer runs than `len` can hold are split up.
+struct HighlightSpan {
+    unsigned short len;
+    unsigned char type;
+};
+
+// State of the highlighter at index `at` of a long row.
+struct HighlightCheckpoint {
+    int at;
+    struct HighlightState state;
+
+    // Whether the row was edited in between this checkpoint and the one 
+    // before it since it was made.
+    bool afterEdit;
+};
 
+// Extra state of a row that is at least TERMINAL_EDITOR_LONG_ROW_SIZE long. 
+// Such rows have no `render` and `highlight` arrays, the part that is on 
+// screen is rendered and highlighted as it is drawn instead.
+struct LongRow {
+    // The row's `chars` has a gap of `gapLen` unused bytes at `gapStart`, so 
+    // that edits at the same spot as the last one don't move the rest of 
+    // the row. The gap is moved out of the way when the row is needed in 
+    // one piece.
+    int gapStart;
+    int gapLen;
+
+    // Amount of tabs in the row. Without any, rendering the row maps each 
+    // character to one column.
+    int tabAmt;
+
+    // Highlighter states at token boundaries throughout the row, assuming it 
+    // starts inside a multi-line comment if `startsInComment` is set. The 
+    // first `validAmt` are up to date, the rest come from before the last 
+    // edit and are compared against to stop rehighlighting early.
+    bool startsInComment;
+    struct HighlightCheckpoint *checkpoints;
+    int checkpointAmt;
+    int checkpointCapacity;
+    int validAmt;
+
+    // Rendered column of every TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACINGth 
+    // character of the row, for rows with tabs. The first `columnAmt` are 
+    // up to date, an edit outdates the ones after it.
+    int *columns;
+    int columnAmt;
+    int columnCapacity;
+};
+
+// A line of the file. There is one for every line, so the fields are ordered 
+// to avoid padding and the flags are packed into bit-fields, which keeps a 
+// row at 48 bytes.
+struct TextRow {
     int size;
+
+    // Value of the editor's `charsEpoch` when `chars` was allocated. Buffers 
+    // from before a background save started are being written out by it, so 
+    // they are not modified or freed in place until it is done.
+    unsigned int charsEpoch;
+
     char *chars;
 
-    int renderSize;
+    // Set for long rows, NULL otherwise.
+    struct LongRow *longRow;
+
+    // NULL when the row has no tabs, since it then renders as its `chars`.
     char *render;
 
-    unsigned char *highlight;
+    // NULL when the whole row is HL_NORMAL.
+    struct HighlightSpan *highlight;
+
+    int renderSize;
+
+    // Whether `chars` points into the file's contents as they were loaded, 
+    // either the memory mapped file or a slab it was read into. Such rows are 
+    // not null terminated and are only copied into their own buffer once 
+    // edited.
+    bool charsMapped : 1;
+
+    // Whether `render` and `highlight` are up to date with `chars`. They are 
+    // only built once the row is first drawn or searched through.
+    bool renderValid : 1;
+    bool highlightValid : 1;
+
+    // Whether the row ends inside a multi-line comment, worked out assuming 
+    // that it starts inside one if `startsInMultiLineComment` is set. Both are 
+    // only meaningful when `multiLineStateValid` is set.
+    bool partOfMultiLineComment : 1;
+    bool startsInMultiLineComment : 1;
+    bool multiLineStateValid : 1;
+};
+
+// State of a file that is still being loaded. Files are loaded in chunks in 
+// between keypresses, so the editor is usable before the whole file is read.
+struct FileLoad {
+    bool active;
+
+    // The stream the file is read from when it is not memory mapped. It is 
+    // read a chunk at a time into `pending`, which becomes a slab that the 
+    // loaded rows point into once it holds a complete line. Until then, it 
+    // holds the start of a line that was cut off at the end of the last 
+    // slab, and grows as more of the line is read.
+    FILE *fp;
+    char *pending;
+    size_t pendingLen;
+    size_t pendingCapacity;
+
+    // Amount of bytes loaded so far, out of the file's total size (0 when 
+    // the size is unknown).
+    size_t offset;
+    size_t size;
+
+    // Index of the row where the next loaded line goes.
+    int nextRow;
+};
+
+struct AppendBuf {
+    char *buf;
+    size_t len;
+    size_t capacity;
+};
+
+#define NEW_APPEND_BUF {NULL, 0, 0}
+
+// Bytes read from the terminal that were not turned into keys yet. Input is 
+// read as many bytes at a time as are available.
+struct InputBuf {
+    char buf[TERMINAL_EDITOR_INPUT_BUF_SIZE];
+    int start;
+    int len;
+};
+
+// Things that happen at a later time, while the editor waits for input.
+enum EditorTimer {
+    TIMER_STATUS_MSG = 0,   // the status message expires
+    TIMER_JOURNAL_SYNC,     // the journal is synced to disk
+    TIMER_FRAME,            // a frame held back by the frame rate cap is drawn
+    TIMER_AMT
+};
+
+// A timer calls its callback once its deadline passes, and is then disarmed 
+// until it is armed again. The callback returns whether the screen needs to 
+// be redrawn.
+struct Timer {
+    bool armed;
+    struct timespec deadline;
+    bool (*callback)();
+};
+
+// Journal of the edits made since the file was last saved, kept in a file 
+// next to it. When the editor dies before saving, the edits are replayed 
+// over the file the next time it is opened. Edits are appended to `pending` 
+// as they are made, written to the journal file once the editor is idle, 
+// and synced to disk every TERMINAL_EDITOR_JOURNAL_SYNC_MS.
+struct Journal {
+    // The journal file, -1 until the first edit creates it.
+    int fd;
+    char *path;
+
+    struct AppendBuf pending;
+
+    // Bytes of edits written to the journal file so far, past its header.
+    off_t size;
+
+    // Whether there are written bytes that are not synced yet.
+    bool unsynced;
+
+    // Offset of the end of the journal when the running background save 
+    // took its snapshot. The edits past it are kept once the save is done.
+    off_t saveOffset;
+
+    // Set while edits must not be journaled, like when loading the file.
+    bool paused;
+};
+
+// Start of a journal file. The journal applies to the file with the 
+// recorded size and modification time.
+struct JournalHeader {
+    char magic[8];
+    long long fileSize;
+    long long mtimeSec;
+    long long mtimeNsec;
+};
+
+#define JOURNAL_MAGIC "TEJRNL01"
+
+// A save running in a background thread. It writes out `iov`, a snapshot of 
+// the rows taken when the save started, while editing goes on. The `chars` 
+// buffers of the rows are shared with the snapshot, so edited rows get a 
+// new copy of their buffer, and the old ones are put into `garbage` to be 
+// freed once the save is done.
+struct SaveJob {
+    bool active;
+    pthread_t thread;
+
+    char *path;
+    mode_t mode;
+
+    struct iovec *iov;
+    int iovAmt;
+    int iovCapacity;
+
+    // The buffer version and `chars` epoch of the snapshot.
+    unsigned long version;
+    unsigned int epoch;
+
+    char **garbage;
+    int garbageAmt;
+    int garbageCapacity;
+
+    // Set by the thread when it is done, along with `error` on failure.
+    ssize_t written;
+    int error;
+
+    // The thread writes a byte into the pipe once it is done, to wake up 
+    // the main loop.
+    int wakeFds[2];
+};
+
+// Primitive edits of the buffer, as recorded in the undo log and the journal. 
+// Each one is listed next to the edit that reverts it, which is found by 
+// flipping the lowest bit.
+enum EditOp {
+    EDIT_INSERT_TEXT = 0,
+    EDIT_DELETE_TEXT,
+    EDIT_INSERT_ROW,
+    EDIT_DELETE_ROW,
+};
+
+// An edit of `len` bytes of text at column `col` of row `row`. Text edits 
+// insert or delete the text within the row, row edits insert or delete the 
+// whole row, whose contents are the text.
+struct UndoEntry {
+    unsigned char op;
+    int row;
+    int col;
+    int len;
+
+    // Offset of the edit's text in the log's text arena.
+    size_t text;
+};
+
+// The edits made by one undo step, along with where the cursor was before 
+// and after them.
+struct UndoGroup {
+    int firstEntry;
+    int cursorX;
+    int cursorY;
+    int afterCursorX;
+    int afterCursorY;
+};
+
+// Keys are sorted into kinds, and consecutive keys of the same kind are 
+// undone together.
+enum UndoKeyKind {
+    UNDO_KEY_OTHER = 0,
+    UNDO_KEY_TYPING,
+    UNDO_KEY_DELETING,
+};
+
+// Log of the edits made to the buffer. The groups before `doneAmt` can be 
+// undone, the ones after it were undone and can be redone. The text of all 
+// the edits is kept back to back in a single arena, so the log only takes 
+// as much memory as the edits themselves.
+struct UndoLog {
+    struct UndoEntry *entries;
+    int entryAmt;
+    int entryCapacity;
+
+    struct UndoGroup *groups;
+    int groupAmt;
+    int groupCapacity;
+    int doneAmt;
+
+    struct AppendBuf text;
+
+    // Whether the last group still takes new edits.
+    bool open;
+
+    // The kind of the last key, and whether more input was already waiting 
+    // once it was processed, like when text is pasted into the terminal. 
+    // Such keys all go into the same group.
+    enum UndoKeyKind lastKind;
+    bool burst;
+
+    // Set while edits must not be recorded, like when loading the file or 
+    // undoing an edit.
+    bool paused;
+};
+
+struct SgrCode {
+    char seq[12];
+    int len;
+};
+
+// A search query compiled for matching.
+struct SearchPattern {
+    // The pattern, lowercased when ignoring case.
+    char *text;
+    int len;
+    int flags;
+
+    // How far the pattern can be shifted along the text based on the byte 
+    // under its last position (Horspool's bad character table).
+    int shift[256];
+
+    // The compiled pattern in regular expression mode. It is NULL and 
+    // `error` describes the problem when the pattern is malformed.
+    struct Regex *regex;
+    const char *error;
+
+    // Scratch space for the positions where regular expression matches 
+    // begin and end, so each copy of the pattern can be used by its own 
+    // thread.
+    bool *starts;
+    int *ends;
+    int startsCapacity;
+};
+
+// A match of the search query in the text.
+struct SearchMatch {
+    int row;
+    int col;
+    int len;
+};
+
+// A range of rows scanned by one of the search workers, with its matches.
+struct SearchChunk {
+    int startRow;
+    int endRow;
+    bool done;
+
+    struct SearchMatch *matches;
+    int matchAmt;
+    int matchCapacity;
+};
+
+// Worker threads for scanning large buffers. The threads are started by 
+// the first scan that needs them and wait for the next scan after that. 
+// Everything but `canceled` is only accessed with `lock` held.
+struct SearchPool {
+    pthread_t threads[TERMINAL_EDITOR_SEARCH_MAX_THREADS];
+    int threadAmt;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t chunkDone;
+
+    // The scanned query. Workers compile their own copy of the pattern 
+    // whenever `generation` changes.
+    const char *query;
+    int flags;
+    unsigned int generation;
+
+    // Chunks are handed out in order starting at `firstChunk`, the one 
+    // holding the origin of the search, wrapping around to the first one.
+    struct SearchChunk *chunks;
+    int chunkAmt;
+    int chunkCapacity;
+    int firstChunk;
+    int dispatchedAmt;
+    int doneAmt;
+
+    bool canceled;
+};
+
+// The matches of the current search, in row order. Kept up to date as rows 
+// are edited until the search is canceled or another one is started.
+struct SearchIndex {
+    bool active;
+    char *query;
+    int flags;
+    struct SearchPattern pattern;
+
+    struct SearchMatch *matches;
+    int matchAmt;
+    int matchCapacity;
+
+    // Index of the selected match, -1 when there are no matches.
+    int current;
+
+    // Whether the selected match is highlighted on screen, while the search 
+    // prompt is open.
+    bool highlightCurrent;
+
+    // Where the search started. A new query selects its first match at or 
+    // after this position.
+    int originRow;
+    int originCol;
+
+    // Edits made while `batchDepth` is above zero only note the rows they 
+    // touched, from `batchStart` up to `batchEnd` in the current row 
+    // numbers, and that `batchDelta` rows were inserted among them. The 
+    // index is updated for all of them when the batch ends.
+    int batchDepth;
+    bool batchEdited;
+    int batchStart;
+    int batchEnd;
+    int batchDelta;
+
+    struct SearchPool pool;
+};
+
+// The contents of a line of the screen, one attribute byte per character.
+struct ScreenLine {
+    char *chars;
+    unsigned char *attrs;
+    int len;
+};
+
+struct Screen {
+    int rows;
+    int cols;
+
+    // The frame being drawn, and the last frame written to the terminal.
+    struct ScreenLine *lines;
+    struct ScreenLine *shadow;
+
+    // Whether `shadow` matches what is on the terminal.
+    bool shadowValid;
+
+    // Where the cursor was left by the last frame.
+    int cursorRow;
+    int cursorCol;
+
+    // A scroll of the lines from `scrollTop` up to `scrollBottom` by 
+    // `scrollAmount` lines, to be done by the terminal on the next flush.
+    int scrollTop;
+    int scrollBottom;
+    int scrollAmount;
+
+    // Whether the terminal supports synchronized output, so frames can be 
+    // shown all at once.
+    bool syncOutput;
+
+    // Escape sequences that switch to each cell attribute.
+    struct SgrCode sgrTable[256];
+
+    // Buffer that frames are written out of, reused across frames.
+    struct AppendBuf frame;
 
-    bool partOfMultiLineComment;
+    // Bytes written to the terminal for the last frame and for all frames 
+    // that wrote anything.
+    size_t lastFrameBytes;
+    size_t totalFrameBytes;
+    size_t frameAmt;
+
+    // When the last frame was drawn, and how many frames were never drawn 
+    // because more keys were waiting or the frame rate cap held them back.
+    struct timespec lastFrameTime;
+    size_t skippedFrameAmt;
 };
 
 struct EditorConfig {
@@ -100,16 +669,60 @@ struct EditorConfig {
     int termCols;
 
     int rowAmt;
-    struct TextRow *rows;
+    struct RowNode *rowRoot;
 
     char *filename;
 
+    // The memory mapped contents of the opened file, if it was mapped.
+    char *fileMap;
+    size_t fileMapSize;
+
+    struct FileLoad load;
+
+    // Shown until TIMER_STATUS_MSG goes off.
     char statusMsg[80];
-    time_t statusMsgTime;
+
+    // Set while a prompt is shown in the message bar, which keeps it from 
+    // expiring.
+    bool prompting;
+
+    // Shown after the prompt, for the prompt callback to report on the input.
+    char promptInfo[64];
+
+    struct SearchIndex search;
+
+    struct UndoLog undo;
+
+    struct Journal journal;
 
     struct EditorSyntax *syntax;
 
-    bool isDirty;
+    struct Screen screen;
+
+    struct InputBuf input;
+
+    struct Timer timers[TIMER_AMT];
+
+    // Pipe that the SIGWINCH handler writes to, to wake the editor up when 
+    // the terminal is resized.
+    int resizeFds[2];
+
+    // The rows before `syntaxStateEnd` have an up to date multi-line comment 
+    // state. Edits move it back, and drawing rows moves it forward again.
+    // `syntaxStateHighWater` is the furthest it got, rows up to it are 
+    // caught up with in idle time after an edit.
+    int syntaxStateEnd;
+    int syntaxStateHighWater;
+
+    // Incremented by every edit. The buffer is dirty when it differs from 
+    // the version that was last saved.
+    unsigned long version;
+    unsigned long savedVersion;
+
+    struct SaveJob save;
+
+    // Incremented whenever a background save starts, see `TextRow.charsEpoch`.
+    unsigned int charsEpoch;
 
     // Caches the original terminal attributes for later cleanup.
     struct termios ogTermios;
@@ -163,6 +776,7 @@ struct EditorSyntax highlightDb[] = {
         "/*",
         "*/",
         HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+        NULL,
     },
 };
 
@@ -171,27 +785,31 @@ struct EditorSyntax highlightDb[] = {
 /*
  * "Append Buffer" type.
  */
-struct AppendBuf {
-    char *buf;
-    size_t len;
-};
-
-#define NEW_APPEND_BUF {NULL, 0}
-
 void bufAppend(struct AppendBuf *aBuf, const char *s, int len) {
-    // Reallocate the underlying buffer for the string content.
-    char *newBuf = realloc(aBuf->buf, aBuf->len + len);
-    if (newBuf == NULL) {
-        return;
+    // Grow the underlying buffer geometrically, so appending many small 
+    // strings only reallocates it a few times.
+    if (aBuf->len + len > aBuf->capacity) {
+        size_t newCapacity = (aBuf->capacity > 0)? aBuf->capacity * 2 : 256;
+        while (newCapacity < aBuf->len + len) {
+            newCapacity *= 2;
+        }
+        char *newBuf = realloc(aBuf->buf, newCapacity);
+        if (newBuf == NULL) {
+            return;
+        }
+        aBuf->buf = newBuf;
+        aBuf->capacity = newCapacity;
     }
-    // Copy the source string `s` onto the new portion of the re-allocated buffer.
-    memcpy(&newBuf[aBuf->len], s, len);
-
-    // Update the structure's fields.
-    aBuf->buf = newBuf;
+    // Copy the source string `s` onto the end of the buffer.
+    memcpy(&aBuf->buf[aBuf->len], s, len);
     aBuf->len += len;
 }
 
+// Empties the buffer while keeping its memory around for reuse.
+void clearAppendBuf(struct AppendBuf *aBuf) {
+    aBuf->len = 0;
+}
+
 void freeAppendBuf(struct AppendBuf *aBuf) {
     free(aBuf->buf);
 }
@@ -201,7 +819,24 @@ void freeAppendBuf(struct AppendBuf *aBuf) {
  */
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+void editorShowFrameStats();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorSearchRowInserted(int fileRow);
+void editorSearchRowDeleted(int fileRow);
+void editorSearchRowChanged(int fileRow, int at, int delta);
+void editorSearchBeginBatch();
+void editorSearchEndBatch();
+void editorSearchProgress(const struct SearchMatch *match);
+void editorFinishSave();
+bool editorWaitForInput();
+void editorHandleResize();
+void editorFinishLoading();
+int saveOpenTempFileFor(const char *path, char **tmpPath);
+void editorRecordEdit(enum EditOp op, int fileRow, int col, const char *text, int len);
+void editorRowOwnChars(struct TextRow *row);
+const char *editorRowRenderChars(struct TextRow *row);
+void editorRowCheckLong(struct TextRow *row);
+bool longRowEndsInComment(struct TextRow *row, bool startsInComment);
 
 /*
  * Terminal handling.
@@ -249,6 +884,7 @@ void die(const char *s) {
 }
 
 void disableRawMode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDERR_FILENO, TCSAFLUSH, &editor.ogTermios) == -1) {
         die("tcsetattr");
     }
@@ -284,22 +920,74 @@ void enableTermRawMode() {
     // - signal processing (i.e. from CTRL-C or CTRL-Z)
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 
+    // Make `read()` return right away, with whatever input there is. Waiting 
+    // for input is done with `poll()`, along with everything else.
     raw.c_cc[VMIN] = 0;     // minimum # of bytes before `read()` can return
-    raw.c_cc[VTIME] = 1;    // delay (in 10ths of a second) to wait before `read()` returns
+    raw.c_cc[VTIME] = 0;    // delay (in 10ths of a second) to wait before `read()` returns
 
     // Set the modified terminal attributes.
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
         die("tcsetattr");
     }
+
+    // Enable bracketed paste mode, so pasted text arrives as a single block 
+    // between two escape sequences instead of as keypresses.
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+// Reads as much input as is available into the input buffer, waiting for 
+// `timeoutMs` milliseconds at most for some to arrive. Returns the amount of 
+// bytes read.
+int inputFill(int timeoutMs) {
+    struct InputBuf *input = &editor.input;
+    if (input->start == input->len) {
+        input->start = 0;
+        input->len = 0;
+    }
+    else if (input->len == TERMINAL_EDITOR_INPUT_BUF_SIZE) {
+        memmove(input->buf, &input->buf[input->start], input->len - input->start);
+        input->len -= input->start;
+        input->start = 0;
+    }
+
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeoutMs);
+    } while (ready == -1 && errno == EINTR);
+    if (ready <= 0) {
+        return 0;
+    }
+
+    int nread = read(STDIN_FILENO, &input->buf[input->len], TERMINAL_EDITOR_INPUT_BUF_SIZE - input->len);
+    if (nread == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            die("read");
+        }
+        return 0;
+    }
+    input->len += nread;
+    return nread;
+}
+
+// Takes the next byte of input, reading more if needed. Returns false if 
+// none arrived within `timeoutMs` milliseconds.
+bool inputReadByte(char *ch, int timeoutMs) {
+    struct InputBuf *input = &editor.input;
+    if (input->start == input->len && inputFill(timeoutMs) == 0) {
+        return false;
+    }
+    *ch = input->buf[input->start++];
+    return true;
 }
 
-// Waits for a key press before returning.
+// Waits for a key press before returning. Whatever else happens in the 
+// meantime is handled, and shown, while waiting.
 int editorReadKey() {
-    int nread;
     char ch;
-    while ((nread = read(STDIN_FILENO, &ch, 1) != 1)) {
-        if (nread == -1 && errno != EAGAIN) {
-            die("read");
+    while (!inputReadByte(&ch, 0)) {
+        if (!editorWaitForInput()) {
+            editorRefreshScreen();
         }
     }
 
@@ -311,18 +999,18 @@ int editorReadKey() {
     // The logic below reads past the first two bytes of the escape sequence and then
     // maps the A, B, C, or D as ARROW_UP, ARROW_DOWN, ARROW_RIGHT, or ARROW_LEFT, respectively.
     if (ch == '\x1b') {
-        char seq[3];
+        char seq[5];
 
-        if (read(STDOUT_FILENO, &seq[0], 1) != 1) {
+        if (!inputReadByte(&seq[0], TERMINAL_EDITOR_ESC_TIMEOUT_MS)) {
             return '\x1b';
         }
-        if (read(STDOUT_FILENO, &seq[1], 1) != 1) {
+        if (!inputReadByte(&seq[1], TERMINAL_EDITOR_ESC_TIMEOUT_MS)) {
             return '\x1b';
         }
 
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) {
+                if (!inputReadByte(&seq[2], TERMINAL_EDITOR_ESC_TIMEOUT_MS)) {
                     return '\x1b';
                 }
                 if (seq[2] == '~') {
@@ -336,6 +1024,18 @@ int editorReadKey() {
                         case '8': return END_KEY;
                     }
                 }
+                // The start and end of a paste: "\x1b[200~" and "\x1b[201~".
+                else if (seq[1] == '2' && seq[2] == '0') {
+                    if (!inputReadByte(&seq[3], TERMINAL_EDITOR_ESC_TIMEOUT_MS) || !inputReadByte(&seq[4], TERMINAL_EDITOR_ESC_TIMEOUT_MS)) {
+                        return '\x1b';
+                    }
+                    if (seq[4] == '~' && seq[3] == '0') {
+                        return PASTE_START;
+                    }
+                    if (seq[4] == '~' && seq[3] == '1') {
+                        return PASTE_END;
+                    }
+                }
             }
             else {
                 switch (seq[1]) {
@@ -362,6 +1062,48 @@ int editorReadKey() {
     }
 }
 
+// Reads the text of a paste, after its PASTE_START key was read, up to the 
+// sequence that ends it. The text is taken out of the input buffer in bulk, 
+// a whole buffer's worth at a time.
+void editorReadPaste(struct AppendBuf *text) {
+    static const char pasteEnd[] = "\x1b[201~";
+    const int pasteEndLen = sizeof(pasteEnd) - 1;
+    struct InputBuf *input = &editor.input;
+
+    while (true) {
+        char *avail = &input->buf[input->start];
+        int availLen = input->len - input->start;
+
+        char *end = memmem(avail, availLen, pasteEnd, pasteEndLen);
+        if (end != NULL) {
+            bufAppend(text, avail, end - avail);
+            input->start += end - avail + pasteEndLen;
+            return;
+        }
+
+        // Keep the bytes that could be the start of the end sequence.
+        int take = (availLen > pasteEndLen)? availLen - pasteEndLen : 0;
+        bufAppend(text, avail, take);
+        input->start += take;
+
+        // A paste whose end never arrives ends once the input stops.
+        if (inputFill(TERMINAL_EDITOR_ESC_TIMEOUT_MS) == 0) {
+            bufAppend(text, &input->buf[input->start], input->len - input->start);
+            input->start = input->len;
+            return;
+        }
+    }
+}
+
+// Whether there is input waiting to be read from the terminal.
+bool editorInputPending() {
+    if (editor.input.start < editor.input.len) {
+        return true;
+    }
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
 int getCursorPosition(int *rows, int *cols) {
     if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) {
         return -1;
@@ -372,7 +1114,7 @@ int getCursorPosition(int *rows, int *cols) {
 
     // Read the cursor position report into the buffer.
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) {
+        if (!inputReadByte(&buf[i], TERMINAL_EDITOR_ESC_TIMEOUT_MS)) {
             break;
         }
         if (buf[i] == 'R') {
@@ -394,6 +1136,39 @@ int getCursorPosition(int *rows, int *cols) {
     return 0;
 }
 
+// Asks the terminal whether it supports synchronized output (mode 2026). 
+// The query is followed by a device attributes request, which every 
+// terminal answers, so there is a reply to wait for even when the query 
+// itself is ignored.
+bool getSyncOutputSupport() {
+    if (write(STDOUT_FILENO, "\x1b[?2026$p\x1b[c", 12) != 12) {
+        return false;
+    }
+
+    char buf[64];
+    unsigned int i = 0;
+
+    // Read the replies up to the end of the device attributes report.
+    while (i < sizeof(buf) - 1) {
+        if (!inputReadByte(&buf[i], TERMINAL_EDITOR_ESC_TIMEOUT_MS)) {
+            break;
+        }
+        if (buf[i] == 'c') {
+            break;
+        }
+        i++;
+    }
+    buf[i] = '\0';
+
+    // The mode is reported as set (1) or reset (2) when it is supported.
+    int mode;
+    char *report = strstr(buf, "\x1b[?2026;");
+    if (report == NULL || sscanf(&report[8], "%d", &mode) != 1) {
+        return false;
+    }
+    return mode == 1 || mode == 2;
+}
+
 int getWindowSize(int *rows, int *cols) {
     struct winsize ws;
 
@@ -417,71 +1192,800 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
+void handleWindowResize(int sig) {
+    (void)sig;
+    int savedErrno = errno;
+    write(editor.resizeFds[1], "r", 1);
+    errno = savedErrno;
+}
+
+// Makes the terminal being resized wake the editor up, through a pipe that 
+// is polled along with the input.
+void watchWindowSize() {
+    if (pipe(editor.resizeFds) == -1) {
+        die("pipe");
+    }
+    // A burst of resizes must never block the handler once the pipe is full.
+    for (int i = 0; i < 2; ++i) {
+        fcntl(editor.resizeFds[i], F_SETFL, O_NONBLOCK);
+        fcntl(editor.resizeFds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleWindowResize;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGWINCH, &action, NULL) == -1) {
+        die("sigaction");
+    }
+}
+
 /*
- * Syntax highlighting. 
+ * Timers.
+ *
+ * The editor sleeps in `poll()` until there is input, or until the earliest 
+ * armed timer is due. There are only a few timers, so finding that one is 
+ * a scan over all of them.
  */
 
-bool isSeparator(int c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+// Returns how many milliseconds passed since `since`.
+long long timerElapsedMs(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000LL + (now.tv_nsec - since->tv_nsec) / 1000000;
 }
 
-void editorUpdateSyntax(struct TextRow *row) {
-    row->highlight = realloc(row->highlight, row->renderSize);
-    memset(row->highlight, HL_NORMAL, row->renderSize);
+// Arms `which` to go off in `ms` milliseconds, replacing its deadline if 
+// it was armed already.
+void timerArm(enum EditorTimer which, int ms) {
+    struct Timer *timer = &editor.timers[which];
+    clock_gettime(CLOCK_MONOTONIC, &timer->deadline);
+    timer->deadline.tv_sec += ms / 1000;
+    timer->deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (timer->deadline.tv_nsec >= 1000000000L) {
+        timer->deadline.tv_sec++;
+        timer->deadline.tv_nsec -= 1000000000L;
+    }
+    timer->armed = true;
+}
 
-    // If `editor.syntax` is not set then no file type was detected for the current file 
-    // and no syntax highlighting will take place.
-    if (editor.syntax == NULL) {
-        return;
+// Returns how many milliseconds are left until the earliest armed timer is 
+// due, rounded up, or -1 if none is armed.
+int timersNextTimeout() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long next = -1;
+    for (int i = 0; i < TIMER_AMT; ++i) {
+        struct Timer *timer = &editor.timers[i];
+        if (!timer->armed) {
+            continue;
+        }
+        long long leftNs = (timer->deadline.tv_sec - now.tv_sec) * 1000000000LL 
+            + (timer->deadline.tv_nsec - now.tv_nsec);
+        long long left = (leftNs > 0)? (leftNs + 999999) / 1000000 : 0;
+        if (next == -1 || left < next) {
+            next = left;
+        }
     }
+    return (next > INT_MAX)? INT_MAX : next;
+}
 
-    char **keywords = editor.syntax->keywords;
+// Runs the callbacks of the timers that are due. Returns whether any of 
+// them needs the screen to be redrawn.
+bool timersRun() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    bool redraw = false;
+    for (int i = 0; i < TIMER_AMT; ++i) {
+        struct Timer *timer = &editor.timers[i];
+        bool due = now.tv_sec > timer->deadline.tv_sec 
+            || (now.tv_sec == timer->deadline.tv_sec && now.tv_nsec >= timer->deadline.tv_nsec);
+        if (timer->armed && due) {
+            timer->armed = false;
+            redraw |= timer->callback();
+        }
+    }
+    return redraw;
+}
 
-    char *singleLineCommentStart = editor.syntax->singleLineCommentStart;
-    char *multiCommentStart = editor.syntax->multiLineCommentStart;
-    char *multiCommentEnd = editor.syntax->multilineCommentEnd;
+/*
+ * Row storage.
+ *
+ * The rows of the file are kept in a B+ tree. Leaves hold chunks of rows 
+ * and internal nodes hold the amount of rows under each of their children. 
+ * A row's index is never stored anywhere, it is implied by its position in 
+ * the tree, so inserting, deleting or looking up a row only touches the 
+ * nodes along a single root-to-leaf path.
+ *
+ * Internal nodes also hold the amount of bytes under each of their children, 
+ * counting a line feed after every row like the saved file does. Like the 
+ * row indices, byte offsets are implied by the tree, so a row's offset in 
+ * the file and the row at a given offset are found along a single path too.
+ */
 
-    int singleLineCommentLen = (singleLineCommentStart)? strlen(singleLineCommentStart) : 0;
-    int multiCommentStartLen = (multiCommentStart)? strlen(multiCommentStart) : 0;
-    int multiCommentEndLen = (multiCommentEnd)? strlen(multiCommentEnd) : 0;
+#define ROW_LEAF_CAPACITY 64
+#define ROW_NODE_CAPACITY 32
 
-    bool prevWasSep = true;
-    bool inString = false; 
-    char stringDelim = '\0';
+struct RowLeaf {
+    int rowAmt;
+    struct TextRow rows[ROW_LEAF_CAPACITY];
 
-    bool inComment = (row->idx > 0 && editor.rows[row->idx - 1].partOfMultiLineComment);
-    
-    int i = 0;
-    while (i < row->renderSize) {
-        char c = row->render[i];
-        unsigned char prevHighlight = (i > 0)? row->highlight[i - 1] : HL_NORMAL;
+    // Leaves are linked together to allow for cheap in-order traversals.
+    struct RowLeaf *prev;
+    struct RowLeaf *next;
+};
 
-        // Syntax highlighting for single line comments.
-        if (singleLineCommentLen > 0 && !inString && !inComment) {
-            if (!strncmp(&row->render[i], singleLineCommentStart, singleLineCommentLen)) {
-                memset(&row->highlight[i], HL_COMMENT, row->renderSize - i);
-                break;
-            }
-        }
+union RowChild {
+    struct RowNode *node;
+    struct RowLeaf *leaf;
+};
 
-        // Highlighting for multi line comments.
-        if (multiCommentStartLen > 0 && multiCommentEndLen > 0 && !inString) {
-            if (inComment) {
-                row->highlight[i] = HL_MULTILINE_COMMENT;
-                if (!strncmp(&row->render[i], multiCommentEnd, multiCommentEndLen)) {
-                    memset(&row->highlight[i], HL_COMMENT, multiCommentEndLen);
-                    i += multiCommentEndLen;
-                    inComment = false;
-                    prevWasSep = true;
-                    continue;
-                }
+struct RowNode {
+    // Whether the children of this node are leaves or other nodes.
+    bool isBottom;
+
+    int rowAmt;
+    int childAmt;
+    long long byteAmt;
+
+    // The arrays have an extra slot so that a node can temporarily overflow 
+    // before being split.
+    union RowChild children[ROW_NODE_CAPACITY + 1];
+    int childRowAmts[ROW_NODE_CAPACITY + 1];
+    long long childByteAmts[ROW_NODE_CAPACITY + 1];
+};
+
+// An iterator over consecutive rows of the tree.
+struct RowIter {
+    struct RowLeaf *leaf;
+    int slot;
+};
+
+// Amount of bytes the row takes up in the file, along with its line feed.
+long long rowBytes(const struct TextRow *row) {
+    return row->size + 1;
+}
+
+long long rowLeafBytes(const struct RowLeaf *leaf) {
+    long long bytes = 0;
+    for (int i = 0; i < leaf->rowAmt; ++i) {
+        bytes += rowBytes(&leaf->rows[i]);
+    }
+    return bytes;
+}
+
+struct RowNode *rowNodeNew(bool isBottom) {
+    struct RowNode *node = calloc(1, sizeof(struct RowNode));
+    if (node == NULL) {
+        die("calloc");
+    }
+    node->isBottom = isBottom;
+    return node;
+}
+
+struct RowLeaf *rowLeafNew() {
+    struct RowLeaf *leaf = calloc(1, sizeof(struct RowLeaf));
+    if (leaf == NULL) {
+        die("calloc");
+    }
+    return leaf;
+}
+
+// Returns a tree with a single empty leaf.
+struct RowNode *rowTreeNew() {
+    struct RowNode *root = rowNodeNew(true);
+    root->children[0].leaf = rowLeafNew();
+    root->childRowAmts[0] = 0;
+    root->childByteAmts[0] = 0;
+    root->childAmt = 1;
+    return root;
+}
+
+// Finds the child of `node` that contains the row at index `*at` and turns 
+// `*at` into an index relative to that child. When `forInsert` is set, an 
+// index right past the end of a child also selects that child.
+int rowNodeFindChild(struct RowNode *node, int *at, bool forInsert) {
+    int i;
+    for (i = 0; i < node->childAmt - 1; ++i) {
+        int amt = node->childRowAmts[i];
+        if (*at < amt || (forInsert && *at == amt)) {
+            break;
+        }
+        *at -= amt;
+    }
+    return i;
+}
+
+void rowNodeInsertChild(struct RowNode *node, int i, union RowChild child, int rowAmt, long long byteAmt) {
+    memmove(&node->children[i + 1], &node->children[i], sizeof(union RowChild) * (node->childAmt - i));
+    memmove(&node->childRowAmts[i + 1], &node->childRowAmts[i], sizeof(int) * (node->childAmt - i));
+    memmove(&node->childByteAmts[i + 1], &node->childByteAmts[i], sizeof(long long) * (node->childAmt - i));
+    node->children[i] = child;
+    node->childRowAmts[i] = rowAmt;
+    node->childByteAmts[i] = byteAmt;
+    node->childAmt++;
+}
+
+void rowNodeRemoveChild(struct RowNode *node, int i) {
+    memmove(&node->children[i], &node->children[i + 1], sizeof(union RowChild) * (node->childAmt - i - 1));
+    memmove(&node->childRowAmts[i], &node->childRowAmts[i + 1], sizeof(int) * (node->childAmt - i - 1));
+    memmove(&node->childByteAmts[i], &node->childByteAmts[i + 1], sizeof(long long) * (node->childAmt - i - 1));
+    node->childAmt--;
+}
+
+void rowNodeRecount(struct RowNode *node) {
+    node->rowAmt = 0;
+    node->byteAmt = 0;
+    for (int i = 0; i < node->childAmt; ++i) {
+        node->rowAmt += node->childRowAmts[i];
+        node->byteAmt += node->childByteAmts[i];
+    }
+}
+
+// Moves the rows of `leaf` past the first `keep` ones into a new leaf, which 
+// is linked right after it.
+struct RowLeaf *rowLeafSplit(struct RowLeaf *leaf, int keep) {
+    struct RowLeaf *newLeaf = rowLeafNew();
+
+    newLeaf->rowAmt = leaf->rowAmt - keep;
+    memcpy(newLeaf->rows, &leaf->rows[keep], sizeof(struct TextRow) * newLeaf->rowAmt);
+    leaf->rowAmt = keep;
+
+    newLeaf->prev = leaf;
+    newLeaf->next = leaf->next;
+    if (leaf->next) {
+        leaf->next->prev = newLeaf;
+    }
+    leaf->next = newLeaf;
+    return newLeaf;
+}
+
+// Moves the children of `node` past the first `keep` ones into a new node.
+struct RowNode *rowNodeSplit(struct RowNode *node, int keep) {
+    struct RowNode *newNode = rowNodeNew(node->isBottom);
+
+    newNode->childAmt = node->childAmt - keep;
+    memcpy(newNode->children, &node->children[keep], sizeof(union RowChild) * newNode->childAmt);
+    memcpy(newNode->childRowAmts, &node->childRowAmts[keep], sizeof(int) * newNode->childAmt);
+    memcpy(newNode->childByteAmts, &node->childByteAmts[keep], sizeof(long long) * newNode->childAmt);
+    node->childAmt = keep;
+
+    rowNodeRecount(node);
+    rowNodeRecount(newNode);
+    return newNode;
+}
+
+// Inserts `row` at index `at` of the subtree rooted at `node`. Returns a new 
+// sibling for `node` if it had to be split, NULL otherwise.
+//
+// Full leaves and nodes are split in half, except when appending past their 
+// end, in which case they are left full. This keeps the tree compact when it 
+// is built by appending rows one after the other, like when loading a file.
+struct RowNode *rowNodeInsert(struct RowNode *node, int at, struct TextRow *row) {
+    int i = rowNodeFindChild(node, &at, true);
+    bool appending = (i == node->childAmt - 1);
+
+    if (node->isBottom) {
+        struct RowLeaf *leaf = node->children[i].leaf;
+
+        if (leaf->rowAmt == ROW_LEAF_CAPACITY) {
+            appending = appending && at == leaf->rowAmt;
+            int keep = appending ? leaf->rowAmt : leaf->rowAmt / 2;
+            struct RowLeaf *newLeaf = rowLeafSplit(leaf, keep);
+            union RowChild child = { .leaf = newLeaf };
+            rowNodeInsertChild(node, i + 1, child, newLeaf->rowAmt, rowLeafBytes(newLeaf));
+            node->childRowAmts[i] = leaf->rowAmt;
+            node->childByteAmts[i] = rowLeafBytes(leaf);
+
+            if (at >= leaf->rowAmt) {
+                at -= leaf->rowAmt;
+                leaf = newLeaf;
+                i++;
+            }
+        }
+        memmove(&leaf->rows[at + 1], &leaf->rows[at], sizeof(struct TextRow) * (leaf->rowAmt - at));
+        leaf->rows[at] = *row;
+        leaf->rowAmt++;
+        node->childRowAmts[i]++;
+        node->childByteAmts[i] += rowBytes(row);
+    }
+    else {
+        struct RowNode *child = node->children[i].node;
+        appending = appending && at == child->rowAmt;
+        struct RowNode *newChild = rowNodeInsert(child, at, row);
+
+        node->childRowAmts[i] = child->rowAmt;
+        node->childByteAmts[i] = child->byteAmt;
+        if (newChild) {
+            union RowChild sibling = { .node = newChild };
+            rowNodeInsertChild(node, i + 1, sibling, newChild->rowAmt, newChild->byteAmt);
+        }
+    }
+    node->rowAmt++;
+    node->byteAmt += rowBytes(row);
+
+    if (node->childAmt > ROW_NODE_CAPACITY) {
+        return rowNodeSplit(node, appending ? ROW_NODE_CAPACITY : node->childAmt / 2);
+    }
+    return NULL;
+}
+
+// Fixes up the child `i` of `node` after it fell below half capacity, either 
+// by merging it with a neighbour or by moving some of the neighbour's 
+// rows/children into it.
+void rowNodeRebalance(struct RowNode *node, int i) {
+    if (node->childAmt < 2) {
+        return;
+    }
+    int left = (i + 1 < node->childAmt) ? i : i - 1;
+    int right = left + 1;
+
+    if (node->isBottom) {
+        struct RowLeaf *l = node->children[left].leaf;
+        struct RowLeaf *r = node->children[right].leaf;
+        int total = l->rowAmt + r->rowAmt;
+
+        if (total <= ROW_LEAF_CAPACITY) {
+            memcpy(&l->rows[l->rowAmt], r->rows, sizeof(struct TextRow) * r->rowAmt);
+            l->rowAmt = total;
+            l->next = r->next;
+            if (r->next) {
+                r->next->prev = l;
+            }
+            free(r);
+            rowNodeRemoveChild(node, right);
+        }
+        else {
+            int want = total / 2;
+            if (l->rowAmt < want) {
+                int move = want - l->rowAmt;
+                memcpy(&l->rows[l->rowAmt], r->rows, sizeof(struct TextRow) * move);
+                memmove(r->rows, &r->rows[move], sizeof(struct TextRow) * (r->rowAmt - move));
+                l->rowAmt += move;
+                r->rowAmt -= move;
+            }
+            else {
+                int move = l->rowAmt - want;
+                memmove(&r->rows[move], r->rows, sizeof(struct TextRow) * r->rowAmt);
+                memcpy(r->rows, &l->rows[want], sizeof(struct TextRow) * move);
+                l->rowAmt -= move;
+                r->rowAmt += move;
+            }
+            node->childRowAmts[right] = r->rowAmt;
+            node->childByteAmts[right] = rowLeafBytes(r);
+        }
+        node->childRowAmts[left] = l->rowAmt;
+        node->childByteAmts[left] = rowLeafBytes(l);
+    }
+    else {
+        struct RowNode *l = node->children[left].node;
+        struct RowNode *r = node->children[right].node;
+        int total = l->childAmt + r->childAmt;
+
+        if (total <= ROW_NODE_CAPACITY) {
+            memcpy(&l->children[l->childAmt], r->children, sizeof(union RowChild) * r->childAmt);
+            memcpy(&l->childRowAmts[l->childAmt], r->childRowAmts, sizeof(int) * r->childAmt);
+            memcpy(&l->childByteAmts[l->childAmt], r->childByteAmts, sizeof(long long) * r->childAmt);
+            l->childAmt = total;
+            free(r);
+            rowNodeRemoveChild(node, right);
+        }
+        else {
+            int want = total / 2;
+            if (l->childAmt < want) {
+                int move = want - l->childAmt;
+                memcpy(&l->children[l->childAmt], r->children, sizeof(union RowChild) * move);
+                memcpy(&l->childRowAmts[l->childAmt], r->childRowAmts, sizeof(int) * move);
+                memcpy(&l->childByteAmts[l->childAmt], r->childByteAmts, sizeof(long long) * move);
+                memmove(r->children, &r->children[move], sizeof(union RowChild) * (r->childAmt - move));
+                memmove(r->childRowAmts, &r->childRowAmts[move], sizeof(int) * (r->childAmt - move));
+                memmove(r->childByteAmts, &r->childByteAmts[move], sizeof(long long) * (r->childAmt - move));
+                l->childAmt += move;
+                r->childAmt -= move;
+            }
+            else {
+                int move = l->childAmt - want;
+                memmove(&r->children[move], r->children, sizeof(union RowChild) * r->childAmt);
+                memmove(&r->childRowAmts[move], r->childRowAmts, sizeof(int) * r->childAmt);
+                memmove(&r->childByteAmts[move], r->childByteAmts, sizeof(long long) * r->childAmt);
+                memcpy(r->children, &l->children[want], sizeof(union RowChild) * move);
+                memcpy(r->childRowAmts, &l->childRowAmts[want], sizeof(int) * move);
+                memcpy(r->childByteAmts, &l->childByteAmts[want], sizeof(long long) * move);
+                l->childAmt -= move;
+                r->childAmt += move;
+            }
+            rowNodeRecount(r);
+            node->childRowAmts[right] = r->rowAmt;
+            node->childByteAmts[right] = r->byteAmt;
+        }
+        rowNodeRecount(l);
+        node->childRowAmts[left] = l->rowAmt;
+        node->childByteAmts[left] = l->byteAmt;
+    }
+}
+
+// Removes the row at index `at` of the subtree rooted at `node` and copies 
+// it into `removed`.
+void rowNodeDelete(struct RowNode *node, int at, struct TextRow *removed) {
+    int i = rowNodeFindChild(node, &at, false);
+    bool underflow;
+
+    if (node->isBottom) {
+        struct RowLeaf *leaf = node->children[i].leaf;
+
+        *removed = leaf->rows[at];
+        memmove(&leaf->rows[at], &leaf->rows[at + 1], sizeof(struct TextRow) * (leaf->rowAmt - at - 1));
+        leaf->rowAmt--;
+        underflow = leaf->rowAmt < ROW_LEAF_CAPACITY / 2;
+    }
+    else {
+        struct RowNode *child = node->children[i].node;
+        rowNodeDelete(child, at, removed);
+        underflow = child->childAmt < ROW_NODE_CAPACITY / 2;
+    }
+    node->childRowAmts[i]--;
+    node->rowAmt--;
+    node->childByteAmts[i] -= rowBytes(removed);
+    node->byteAmt -= rowBytes(removed);
+
+    if (underflow) {
+        rowNodeRebalance(node, i);
+    }
+}
+
+void rowTreeInsert(int at, struct TextRow *row) {
+    struct RowNode *sibling = rowNodeInsert(editor.rowRoot, at, row);
+
+    // The root was split, so the tree grows by one level.
+    if (sibling) {
+        struct RowNode *root = rowNodeNew(false);
+        union RowChild left = { .node = editor.rowRoot };
+        union RowChild right = { .node = sibling };
+        rowNodeInsertChild(root, 0, left, editor.rowRoot->rowAmt, editor.rowRoot->byteAmt);
+        rowNodeInsertChild(root, 1, right, sibling->rowAmt, sibling->byteAmt);
+        rowNodeRecount(root);
+        editor.rowRoot = root;
+    }
+}
+
+void rowTreeDelete(int at, struct TextRow *removed) {
+    rowNodeDelete(editor.rowRoot, at, removed);
+
+    // The root only has a single child left, so the tree shrinks by one level.
+    if (!editor.rowRoot->isBottom && editor.rowRoot->childAmt == 1) {
+        struct RowNode *oldRoot = editor.rowRoot;
+        editor.rowRoot = oldRoot->children[0].node;
+        free(oldRoot);
+    }
+}
+
+// Adds `delta` bytes to the byte amounts along the path to the row at index 
+// `at`, after its size changed by that much.
+void rowTreeResize(int at, int delta) {
+    struct RowNode *node = editor.rowRoot;
+    while (true) {
+        int i = rowNodeFindChild(node, &at, false);
+        node->childByteAmts[i] += delta;
+        node->byteAmt += delta;
+        if (node->isBottom) {
+            return;
+        }
+        node = node->children[i].node;
+    }
+}
+
+// Returns the leaf containing the row at index `at`, along with the row's 
+// slot in that leaf.
+struct RowLeaf *rowTreeFindLeaf(int at, int *slot) {
+    struct RowNode *node = editor.rowRoot;
+    while (true) {
+        int i = rowNodeFindChild(node, &at, false);
+        if (node->isBottom) {
+            *slot = at;
+            return node->children[i].leaf;
+        }
+        node = node->children[i].node;
+    }
+}
+
+// Returns the row at index `at`, or NULL if there is no such row.
+// The returned pointer is only valid until the next row insertion or deletion.
+struct TextRow *editorRowAt(int at) {
+    if (at < 0 || at >= editor.rowAmt) {
+        return NULL;
+    }
+    int slot;
+    struct RowLeaf *leaf = rowTreeFindLeaf(at, &slot);
+    return &leaf->rows[slot];
+}
+
+// Returns the amount of bytes in the file before the row at index `at`. 
+// Past the last row, that is the size of the whole file.
+long long editorRowByteOffset(int at) {
+    struct RowNode *node = editor.rowRoot;
+    if (at >= editor.rowAmt) {
+        return node->byteAmt;
+    }
+    long long offset = 0;
+    while (true) {
+        int i = 0;
+        for (; at >= node->childRowAmts[i]; ++i) {
+            at -= node->childRowAmts[i];
+            offset += node->childByteAmts[i];
+        }
+        if (node->isBottom) {
+            struct RowLeaf *leaf = node->children[i].leaf;
+            for (int slot = 0; slot < at; ++slot) {
+                offset += rowBytes(&leaf->rows[slot]);
+            }
+            return offset;
+        }
+        node = node->children[i].node;
+    }
+}
+
+// Returns the index of the row containing the byte at `offset` of the file, 
+// counting its line feed as part of it, or `editor.rowAmt` when `offset` is 
+// past the end of the file.
+int editorRowAtByte(long long offset) {
+    struct RowNode *node = editor.rowRoot;
+    if (offset < 0) {
+        return 0;
+    }
+    if (offset >= node->byteAmt) {
+        return editor.rowAmt;
+    }
+    int at = 0;
+    while (true) {
+        int i = 0;
+        for (; offset >= node->childByteAmts[i]; ++i) {
+            offset -= node->childByteAmts[i];
+            at += node->childRowAmts[i];
+        }
+        if (node->isBottom) {
+            struct RowLeaf *leaf = node->children[i].leaf;
+            int slot = 0;
+            for (; offset >= rowBytes(&leaf->rows[slot]); ++slot) {
+                offset -= rowBytes(&leaf->rows[slot]);
+            }
+            return at + slot;
+        }
+        node = node->children[i].node;
+    }
+}
+
+// Returns an iterator positioned at the row at index `at`.
+struct RowIter editorRowIterAt(int at) {
+    struct RowIter it = { NULL, 0 };
+    if (at >= 0 && at < editor.rowAmt) {
+        it.leaf = rowTreeFindLeaf(at, &it.slot);
+    }
+    return it;
+}
+
+// Returns the row the iterator points to and moves it to the next row.
+// Returns NULL once the iterator runs past the last row.
+struct TextRow *editorRowIterNext(struct RowIter *it) {
+    while (it->leaf && it->slot >= it->leaf->rowAmt) {
+        it->leaf = it->leaf->next;
+        it->slot = 0;
+    }
+    if (it->leaf == NULL) {
+        return NULL;
+    }
+    return &it->leaf->rows[it->slot++];
+}
+
+// Same as `editorRowIterNext` but moves the iterator to the previous row.
+struct TextRow *editorRowIterPrev(struct RowIter *it) {
+    while (it->leaf && it->slot < 0) {
+        it->leaf = it->leaf->prev;
+        it->slot = (it->leaf) ? it->leaf->rowAmt - 1 : 0;
+    }
+    if (it->leaf == NULL) {
+        return NULL;
+    }
+    return &it->leaf->rows[it->slot--];
+}
+
+/*
+ * Syntax highlighting. 
+ */
+
+// Characters that separate words: whitespace, the null character and 
+// ",.()+-/*=~%<>[];". Kept as a table since it is checked for every character.
+const bool separatorTable[256] = {
+    ['\0'] = true, [' '] = true, ['\t'] = true, ['\n'] = true, ['\v'] = true, ['\f'] = true, ['\r'] = true,
+    [','] = true, ['.'] = true, ['('] = true, [')'] = true, ['+'] = true, ['-'] = true, ['/'] = true, 
+    ['*'] = true, ['='] = true, ['~'] = true, ['%'] = true, ['<'] = true, ['>'] = true, ['['] = true, 
+    [']'] = true, [';'] = true,
+};
+
+bool isSeparator(int c) {
+    return separatorTable[(unsigned char)c];
+}
+
+bool isWordChar(int c) {
+    return isalnum(c) || c == '_';
+}
+
+unsigned int keywordHash(const char *word, int len, unsigned int seed) {
+    // FNV-1a, with the seed mixed into the offset basis.
+    unsigned int hash = 2166136261u ^ seed;
+    for (int i = 0; i < len; ++i) {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+// Compiles a keyword list into a perfect hash table, trying seeds until every 
+// keyword lands in its own slot, and growing the table if no seed works.
+struct KeywordTable *editorCompileKeywords(char **keywords) {
+    struct KeywordTable *table = calloc(1, sizeof(struct KeywordTable));
+    if (table == NULL) {
+        die("calloc");
+    }
+
+    int keywordAmt = 0;
+    while (keywords[keywordAmt] != NULL) {
+        keywordAmt++;
+    }
+
+    unsigned int size = 16;
+    while (size < (unsigned int)keywordAmt * 2) {
+        size *= 2;
+    }
+
+    while (true) {
+        table->slots = calloc(size, sizeof(struct KeywordEntry));
+        if (table->slots == NULL) {
+            die("calloc");
+        }
+        table->mask = size - 1;
+
+        for (table->seed = 0; table->seed < 256; ++table->seed) {
+            memset(table->slots, 0, size * sizeof(struct KeywordEntry));
+            table->minLen = INT_MAX;
+            table->maxLen = 0;
+
+            int j;
+            for (j = 0; j < keywordAmt; ++j) {
+                int keywordLen = strlen(keywords[j]);
+                bool isSecondaryKw = keywords[j][keywordLen - 1] == '|';
+
+                // Secondary keywords have an extra marker '|' at the end, we 
+                // decrement the keyword len to take into account the real length.
+                if (isSecondaryKw) {
+                    keywordLen--;
+                }
+
+                struct KeywordEntry *slot = 
+                    &table->slots[keywordHash(keywords[j], keywordLen, table->seed) & table->mask];
+                if (slot->word != NULL) {
+                    break;
+                }
+                slot->word = keywords[j];
+                slot->len = keywordLen;
+                slot->highlight = isSecondaryKw ? HL_KEYWORD2 : HL_KEYWORD1;
+
+                if (keywordLen < table->minLen) {
+                    table->minLen = keywordLen;
+                }
+                if (keywordLen > table->maxLen) {
+                    table->maxLen = keywordLen;
+                }
+            }
+            // Every keyword got its own slot.
+            if (j == keywordAmt) {
+                return table;
+            }
+        }
+        free(table->slots);
+        size *= 2;
+    }
+}
+
+// Returns the highlight of the keyword `word`, or `HL_NORMAL` if it is not 
+// a keyword.
+unsigned char keywordTableLookup(struct KeywordTable *table, const char *word, int len) {
+    if (len < table->minLen || len > table->maxLen) {
+        return HL_NORMAL;
+    }
+    struct KeywordEntry *slot = &table->slots[keywordHash(word, len, table->seed) & table->mask];
+    if (slot->word != NULL && slot->len == len && !memcmp(slot->word, word, len)) {
+        return slot->highlight;
+    }
+    return HL_NORMAL;
+}
+
+// Whether the highlighting of a row depends on the rows before it.
+bool editorSyntaxHasMultiLineState() {
+    return editor.syntax != NULL 
+        && editor.syntax->multiLineCommentStart != NULL 
+        && editor.syntax->multilineCommentEnd != NULL;
+}
+
+// Whether `text` contains `prefix` at index `i`.
+bool textHasPrefixAt(const char *text, int len, int i, const char *prefix, int prefixLen) {
+    return i + prefixLen <= len && !memcmp(&text[i], prefix, prefixLen);
+}
+
+// Highlights `text` into `hl` from index `at`, a token boundary where the 
+// highlighter was in `state`, up to the first token boundary at or past 
+// `stop`, which is returned. `state` is left as it is at that boundary. 
+// Tokens are finished past `stop` by looking at bytes up to `len`, the 
+// length of the whole text.
+int editorHighlightScan(const char *text, int len, int at, int stop, unsigned char *hl, struct HighlightState *state) {
+    if (stop > len) {
+        stop = len;
+    }
+    // If `editor.syntax` is not set then no file type was detected for the current file 
+    // and no syntax highlighting will take place.
+    if (editor.syntax == NULL) {
+        memset(&hl[at], HL_NORMAL, stop - at);
+        return stop;
+    }
+    // The rest of the text is a single line comment.
+    if (state->inLineComment) {
+        memset(&hl[at], HL_COMMENT, len - at);
+        return len;
+    }
+    memset(&hl[at], HL_NORMAL, stop - at);
+
+    struct KeywordTable *keywords = editor.syntax->keywordTable;
+
+    char *singleLineCommentStart = editor.syntax->singleLineCommentStart;
+    char *multiCommentStart = editor.syntax->multiLineCommentStart;
+    char *multiCommentEnd = editor.syntax->multilineCommentEnd;
+
+    int singleLineCommentLen = (singleLineCommentStart)? strlen(singleLineCommentStart) : 0;
+    int multiCommentStartLen = (multiCommentStart)? strlen(multiCommentStart) : 0;
+    int multiCommentEndLen = (multiCommentEnd)? strlen(multiCommentEnd) : 0;
+
+    bool inComment = state->inComment;
+    bool prevWasSep = state->prevWasSep;
+    bool prevWasNumber = state->prevWasNumber;
+    bool inString = state->inString; 
+    char stringDelim = state->stringDelim;
+    
+    int i = at;
+    while (i < stop) {
+        char c = text[i];
+        bool afterNumber = prevWasNumber;
+        prevWasNumber = false;
+
+        // Syntax highlighting for single line comments.
+        if (singleLineCommentLen > 0 && !inString && !inComment) {
+            if (textHasPrefixAt(text, len, i, singleLineCommentStart, singleLineCommentLen)) {
+                memset(&hl[i], HL_COMMENT, len - i);
+                state->inLineComment = true;
+                i = len;
+                break;
+            }
+        }
+
+        // Highlighting for multi line comments.
+        if (multiCommentStartLen > 0 && multiCommentEndLen > 0 && !inString) {
+            if (inComment) {
+                hl[i] = HL_MULTILINE_COMMENT;
+                if (textHasPrefixAt(text, len, i, multiCommentEnd, multiCommentEndLen)) {
+                    memset(&hl[i], HL_COMMENT, multiCommentEndLen);
+                    i += multiCommentEndLen;
+                    inComment = false;
+                    prevWasSep = true;
+                    continue;
+                }
                 else {
                     i++;
                     continue;
                 }
             }
-            else if (!strncmp(&row->render[i], multiCommentStart, multiCommentStartLen)) {
-                memset(&row->highlight[i], HL_COMMENT, multiCommentStartLen);
+            else if (textHasPrefixAt(text, len, i, multiCommentStart, multiCommentStartLen)) {
+                memset(&hl[i], HL_COMMENT, multiCommentStartLen);
                 i += multiCommentStartLen;
                 inComment = true;
                 continue;
@@ -491,11 +1995,11 @@ void editorUpdateSyntax(struct TextRow *row) {
         // Syntax highlighting for strings.
         if (editor.syntax->flags & HL_HIGHLIGHT_STRINGS) {
             if (inString) {
-                row->highlight[i] = HL_STRING;
+                hl[i] = HL_STRING;
 
                 // Highlight escaped single and double quotes.
-                if (c == '\\' && i + 1 < row->renderSize) {
-                    row->highlight[i + 1] = HL_STRING;
+                if (c == '\\' && i + 1 < len) {
+                    hl[i + 1] = HL_STRING;
                     i += 2;
                     continue;
                 }
@@ -513,7 +2017,7 @@ void editorUpdateSyntax(struct TextRow *row) {
                     inString = true;
                     stringDelim = c;
                     
-                    row->highlight[i] = HL_STRING;
+                    hl[i] = HL_STRING;
                     i++;
                     continue;
                 }
@@ -522,490 +2026,4318 @@ void editorUpdateSyntax(struct TextRow *row) {
 
         // Syntax highlighting for numbers.
         if (editor.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if ((isdigit(c) && (prevWasSep || prevHighlight == HL_NUMBER)) || 
-                (c == '.' && prevHighlight == HL_NUMBER)) {
-                row->highlight[i] = HL_NUMBER;
+            if ((isdigit(c) && (prevWasSep || afterNumber)) || (c == '.' && afterNumber)) {
+                hl[i] = HL_NUMBER;
                 i++;
                 prevWasSep = false;
+                prevWasNumber = true;
                 continue;
             }
         }
 
-        // Syntax highlighting for keywords.
+        // Syntax highlighting for keywords. A keyword is a whole word between 
+        // separators, so find where the word ends (giving up once it gets 
+        // longer than any keyword) and look it up.
         if (prevWasSep) {
-            int j;
-            for (j = 0; keywords[j] != NULL; ++j) {
-                int keywordLen = strlen(keywords[j]);
-                bool isSecondaryKw = keywords[j][keywordLen - 1] == '|';
+            int wordEnd = i;
+            while (wordEnd < len && wordEnd - i <= keywords->maxLen && !isSeparator(text[wordEnd])) {
+                wordEnd++;
+            }
+            unsigned char keywordHighlight = keywordTableLookup(keywords, &text[i], wordEnd - i);
 
-                // Secondary keywords have an extra marker '|' at the end, we 
-                // decrement the keyword len to take into account the real length.
-                if (isSecondaryKw) {
-                    keywordLen--;
-                }
+            if (keywordHighlight != HL_NORMAL) {
+                memset(&hl[i], keywordHighlight, wordEnd - i);
+                i = wordEnd;
+                prevWasSep = false;
+                continue;
+            }
+        }
+
+        prevWasSep = isSeparator(c);
+        i++;
+    }
+
+    state->inComment = inComment;
+    state->prevWasSep = prevWasSep;
+    state->prevWasNumber = prevWasNumber;
+    state->inString = inString;
+    state->stringDelim = stringDelim;
+    return i;
+}
+
+// Highlights the `len` bytes of `text` into `hl`, starting inside a 
+// multi-line comment if `inComment` is set. Returns whether the text ends 
+// inside a multi-line comment.
+bool editorHighlightText(const char *text, int len, unsigned char *hl, bool inComment) {
+    struct HighlightState state = { .inComment = inComment, .prevWasSep = true };
+    editorHighlightScan(text, len, 0, len, hl, &state);
+    return state.inComment;
+}
+
+// Amount of bytes past the start of a token that the highlighter might look 
+// at to tell what the token is. An edit can change the highlighting of the 
+// tokens that start up to this far before it.
+int editorHighlightLookahead() {
+    if (editor.syntax == NULL) {
+        return 1;
+    }
+    int lookahead = editor.syntax->keywordTable->maxLen + 1;
+    char *markers[] = { 
+        editor.syntax->singleLineCommentStart, 
+        editor.syntax->multiLineCommentStart, 
+        editor.syntax->multilineCommentEnd,
+    };
+    for (int i = 0; i < 3; ++i) {
+        if (markers[i] != NULL && (int)strlen(markers[i]) > lookahead) {
+            lookahead = strlen(markers[i]);
+        }
+    }
+    return (lookahead > 2)? lookahead : 2;
+}
+
+// Returns a buffer of at least `len` bytes for highlighting a row into, 
+// which is reused by the next call.
+unsigned char *editorHighlightScratch(int len) {
+    static unsigned char *scratch = NULL;
+    static int scratchSize = 0;
+
+    if (len > scratchSize) {
+        scratchSize = len;
+        scratch = realloc(scratch, scratchSize);
+        if (scratch == NULL) {
+            die("realloc");
+        }
+    }
+    return scratch;
+}
+
+// Turns the `len` highlight types of `hl` into a list of spans. Returns NULL 
+// if they are all HL_NORMAL.
+struct HighlightSpan *highlightSpansEncode(const unsigned char *hl, int len) {
+    int spanAmt = 0;
+    bool allNormal = true;
+    for (int i = 0; i < len; ++spanAmt) {
+        int end = i + 1;
+        while (end < len && hl[end] == hl[i] && end - i < USHRT_MAX) {
+            end++;
+        }
+        allNormal = allNormal && hl[i] == HL_NORMAL;
+        i = end;
+    }
+    if (allNormal) {
+        return NULL;
+    }
+
+    struct HighlightSpan *spans = malloc((spanAmt + 1) * sizeof(struct HighlightSpan));
+    if (spans == NULL) {
+        die("malloc");
+    }
+    struct HighlightSpan *span = spans;
+    for (int i = 0; i < len; ++span) {
+        int end = i + 1;
+        while (end < len && hl[end] == hl[i] && end - i < USHRT_MAX) {
+            end++;
+        }
+        span->len = end - i;
+        span->type = hl[i];
+        i = end;
+    }
+    span->len = 0;
+    span->type = HL_NORMAL;
+    return spans;
+}
+
+// Writes the highlight types of the `len` rendered characters from index 
+// `from` onwards to `attrs`, from a row's list of spans.
+void highlightSpansDecode(const struct HighlightSpan *spans, int from, int len, unsigned char *attrs) {
+    if (spans != NULL) {
+        // Skip the spans that end before `from`.
+        int spanStart = 0;
+        while (spans->len != 0 && spanStart + spans->len <= from) {
+            spanStart += spans->len;
+            spans++;
+        }
+        for (int skip = from - spanStart; spans->len != 0 && len > 0; ++spans, skip = 0) {
+            int amt = spans->len - skip;
+            if (amt > len) {
+                amt = len;
+            }
+            memset(attrs, spans->type, amt);
+            attrs += amt;
+            len -= amt;
+        }
+    }
+    memset(attrs, HL_NORMAL, len);
+}
+
+// Highlights the row, whose `render` array must be up to date, as if it 
+// started inside a multi-line comment when `startsInComment` is set.
+void editorUpdateSyntax(struct TextRow *row, bool startsInComment) {
+    unsigned char *hl = editorHighlightScratch(row->renderSize);
+    row->partOfMultiLineComment = editorHighlightText(editorRowRenderChars(row), row->renderSize, 
+        hl, startsInComment);
+
+    free(row->highlight);
+    row->highlight = highlightSpansEncode(hl, row->renderSize);
+
+    row->startsInMultiLineComment = startsInComment;
+    row->multiLineStateValid = true;
+    row->highlightValid = true;
+}
+
+// Works out whether the row ends inside a multi-line comment without keeping 
+// its highlighting around. Used for rows that are not being drawn, so they 
+// never need their `render` and `highlight` arrays built.
+void editorUpdateSyntaxState(struct TextRow *row, bool startsInComment) {
+    // Long rows only rehighlight from around where they were last edited.
+    editorRowCheckLong(row);
+    if (row->longRow != NULL) {
+        row->partOfMultiLineComment = longRowEndsInComment(row, startsInComment);
+        row->startsInMultiLineComment = startsInComment;
+        row->multiLineStateValid = true;
+        return;
+    }
+
+    // Expanding tabs does not change where comments start or end, so the 
+    // comment state can be worked out from `chars` directly.
+    unsigned char *hl = editorHighlightScratch(row->size);
+    row->partOfMultiLineComment = editorHighlightText(row->chars, row->size, hl, startsInComment);
+
+    row->startsInMultiLineComment = startsInComment;
+    row->multiLineStateValid = true;
+
+    // Any highlighting the row still has was made for another starting state.
+    row->highlightValid = false;
+}
+
+// Marks the multi-line comment state of the rows from `fileRow` onwards as 
+// possibly outdated.
+void editorInvalidateSyntaxState(int fileRow) {
+    if (fileRow < editor.syntaxStateEnd) {
+        editor.syntaxStateEnd = fileRow;
+    }
+}
+
+// Brings the multi-line comment state of all the rows before `fileRow` up to 
+// date. Rows whose contents and starting state did not change since they were 
+// last looked at are skipped over.
+void editorSyncSyntaxState(int fileRow) {
+    if (!editorSyntaxHasMultiLineState() || editor.syntaxStateEnd >= fileRow) {
+        return;
+    }
+    int at = editor.syntaxStateEnd;
+    struct TextRow *prevRow = editorRowAt(at - 1);
+    bool inComment = (prevRow != NULL && prevRow->partOfMultiLineComment);
+
+    struct RowIter it = editorRowIterAt(at);
+    for (; at < fileRow; ++at) {
+        struct TextRow *row = editorRowIterNext(&it);
+        if (!row->multiLineStateValid || row->startsInMultiLineComment != inComment) {
+            editorUpdateSyntaxState(row, inComment);
+        }
+        inComment = row->partOfMultiLineComment;
+    }
+
+    editor.syntaxStateEnd = fileRow;
+    if (editor.syntaxStateHighWater < fileRow) {
+        editor.syntaxStateHighWater = fileRow;
+    }
+}
+
+// Catches up on the multi-line comment state of rows that an edit invalidated 
+// past the part of the file that was drawn, a few rows at a time. Returns 
+// whether there is still work left.
+bool editorSyntaxIdleStep() {
+    if (!editorSyntaxHasMultiLineState() || editor.syntaxStateEnd >= editor.syntaxStateHighWater) {
+        return false;
+    }
+    int upTo = editor.syntaxStateEnd + TERMINAL_EDITOR_SYNTAX_IDLE_ROWS;
+    if (upTo > editor.syntaxStateHighWater) {
+        upTo = editor.syntaxStateHighWater;
+    }
+    editorSyncSyntaxState(upTo);
+
+    return editor.syntaxStateEnd < editor.syntaxStateHighWater;
+}
+
+int editorSyntaxToColor(int highlightType) {
+    switch (highlightType) {
+        case HL_COMMENT: 
+        case HL_MULTILINE_COMMENT: return 36;
+        case HL_KEYWORD1: return 33;
+        case HL_KEYWORD2: return 32;
+        case HL_STRING: return 35;
+        case HL_NUMBER: return 31;
+        case HL_MATCH: return 34;
+        default: return 37;
+    }
+}
+
+void editorSelectSyntaxHighlight() {
+    editor.syntax = NULL;
+    if (editor.filename == NULL) {
+        return;
+    }
+
+    char *fileExt = strchr(editor.filename, '.');
+
+    for (unsigned int i = 0; i < HIGHLIGHT_DB_ENTRIES; ++i) {
+        struct EditorSyntax *syntax = &highlightDb[i];
+
+        unsigned int j = 0;
+        while (syntax->fileMatch[j]) {
+            int isExt = (syntax->fileMatch[j][0] == '.');
+
+            if ((isExt && fileExt && !strcmp(fileExt, syntax->fileMatch[j])) || 
+                (!isExt && strstr(editor.filename, syntax->fileMatch[j]))) {
+                editor.syntax = syntax;
+
+                if (syntax->keywordTable == NULL) {
+                    syntax->keywordTable = editorCompileKeywords(syntax->keywords);
+                }
+
+                // Discard the highlighting of all the file's rows after a syntax 
+                // highlighting scheme is determined, they are re-highlighted 
+                // as they get drawn.
+                struct RowIter it = editorRowIterAt(0);
+                struct TextRow *row;
+                while ((row = editorRowIterNext(&it)) != NULL) {
+                    row->highlightValid = false;
+                    row->multiLineStateValid = false;
+                    if (row->longRow != NULL) {
+                        row->longRow->checkpointAmt = 0;
+                        row->longRow->validAmt = 0;
+                    }
+                }
+                editor.syntaxStateEnd = 0;
+                editor.syntaxStateHighWater = 0;
+
+                return;
+            }
+            j++;
+        }
+    }
+}
+
+/*
+ * Long rows.
+ */
+
+// Returns the amount of tabs in the `len` characters of `s`.
+int textCountTabs(const char *s, int len) {
+    int tabAmt = 0;
+    const char *end = s + len;
+    while ((s = memchr(s, '\t', end - s)) != NULL) {
+        tabAmt++;
+        s++;
+    }
+    return tabAmt;
+}
+
+// Returns the character at index `i` of the row, skipping over the gap of a 
+// long row.
+char editorRowCharAt(struct TextRow *row, int i) {
+    if (row->longRow != NULL && i >= row->longRow->gapStart) {
+        i += row->longRow->gapLen;
+    }
+    return row->chars[i];
+}
+
+// Copies the `len` characters of the row starting at index `at` to `dst`.
+void editorRowCopyChars(struct TextRow *row, int at, int len, char *dst) {
+    int gapStart = (row->longRow != NULL)? row->longRow->gapStart : row->size;
+    int gapLen = (row->longRow != NULL)? row->longRow->gapLen : 0;
+
+    int beforeGap = gapStart - at;
+    if (beforeGap < 0) {
+        beforeGap = 0;
+    }
+    if (beforeGap > len) {
+        beforeGap = len;
+    }
+    memcpy(dst, &row->chars[at], beforeGap);
+    memcpy(&dst[beforeGap], &row->chars[at + beforeGap + gapLen], len - beforeGap);
+}
+
+// Turns the row into a long row. Its `render` and `highlight` arrays are 
+// dropped, since only the part of it that is on screen is rendered from 
+// then on.
+void editorRowMakeLong(struct TextRow *row) {
+    struct LongRow *longRow = malloc(sizeof(struct LongRow));
+    if (longRow == NULL) {
+        die("malloc");
+    }
+    longRow->gapStart = row->size;
+    longRow->gapLen = 0;
+    longRow->tabAmt = textCountTabs(row->chars, row->size);
+    longRow->startsInComment = false;
+    longRow->checkpoints = NULL;
+    longRow->checkpointAmt = 0;
+    longRow->checkpointCapacity = 0;
+    longRow->validAmt = 0;
+    longRow->columns = NULL;
+    longRow->columnAmt = 0;
+    longRow->columnCapacity = 0;
+    row->longRow = longRow;
+
+    free(row->render);
+    free(row->highlight);
+    row->render = NULL;
+    row->highlight = NULL;
+    row->renderSize = 0;
+    row->renderValid = false;
+    row->highlightValid = false;
+}
+
+// Turns the row into a long row if it is long enough to be one. Rows stay 
+// long once they are, even if they get shorter.
+void editorRowCheckLong(struct TextRow *row) {
+    if (row->longRow == NULL && row->size >= TERMINAL_EDITOR_LONG_ROW_SIZE) {
+        editorRowMakeLong(row);
+    }
+}
+
+// Moves the gap of a long row to index `at`, first growing it if it has less 
+// than `room` bytes.
+void longRowMoveGap(struct TextRow *row, int at, int room) {
+    editorRowOwnChars(row);
+    struct LongRow *longRow = row->longRow;
+    char *chars = row->chars;
+
+    if (longRow->gapLen < room) {
+        int gapLen = room + row->size / 8 + TERMINAL_EDITOR_GAP_MIN;
+        chars = realloc(chars, row->size + gapLen + 1);
+        if (chars == NULL) {
+            die("realloc");
+        }
+        memmove(&chars[longRow->gapStart + gapLen], &chars[longRow->gapStart + longRow->gapLen], 
+            row->size - longRow->gapStart);
+        longRow->gapLen = gapLen;
+        row->chars = chars;
+    }
+
+    if (at < longRow->gapStart) {
+        memmove(&chars[at + longRow->gapLen], &chars[at], longRow->gapStart - at);
+    }
+    else if (at > longRow->gapStart) {
+        memmove(&chars[longRow->gapStart], &chars[longRow->gapStart + longRow->gapLen], at - longRow->gapStart);
+    }
+    longRow->gapStart = at;
+    chars[row->size + longRow->gapLen] = '\0';
+}
+
+// Returns the row's characters from index `at` to its end in one piece, 
+// moving the gap of a long row out of the way if it is in between.
+char *editorRowCharsFrom(struct TextRow *row, int at) {
+    struct LongRow *longRow = row->longRow;
+    if (longRow == NULL) {
+        return &row->chars[at];
+    }
+    if (at < longRow->gapStart && longRow->gapStart < row->size) {
+        longRowMoveGap(row, at, 0);
+    }
+    return &row->chars[(at >= longRow->gapStart)? at + longRow->gapLen : at];
+}
+
+char *editorRowChars(struct TextRow *row) {
+    return editorRowCharsFrom(row, 0);
+}
+
+// Returns the row's characters in one piece without modifying the row, so it 
+// can be used off the main thread. A long row whose gap is in the way is 
+// copied into `*copy`, which the caller frees.
+const char *editorRowCharsView(struct TextRow *row, char **copy) {
+    *copy = NULL;
+    if (row->longRow == NULL || row->longRow->gapLen == 0 || row->longRow->gapStart == row->size) {
+        return row->chars;
+    }
+    *copy = malloc(row->size + 1);
+    if (*copy == NULL) {
+        die("malloc");
+    }
+    editorRowCopyChars(row, 0, row->size, *copy);
+    (*copy)[row->size] = '\0';
+    return *copy;
+}
+
+bool highlightStatesEqual(const struct HighlightState *a, const struct HighlightState *b) {
+    return a->inComment == b->inComment 
+        && a->inLineComment == b->inLineComment 
+        && a->inString == b->inString 
+        && a->stringDelim == b->stringDelim 
+        && a->prevWasSep == b->prevWasSep 
+        && a->prevWasNumber == b->prevWasNumber;
+}
+
+// Returns the amount of the first `amt` checkpoints of the long row that are 
+// at or before index `at`.
+int longRowFindCheckpoint(struct LongRow *longRow, int at, int amt) {
+    int low = 0;
+    int high = amt;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (longRow->checkpoints[mid].at <= at) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Gets the highlighter state that the `index`th up to date checkpoint of the 
+// long row starts from, which is the start of the row for the first one. 
+// Returns the index into the row the state is at.
+int longRowStateBefore(struct LongRow *longRow, int index, struct HighlightState *state) {
+    if (index == 0) {
+        *state = (struct HighlightState){ .inComment = longRow->startsInComment, .prevWasSep = true };
+        return 0;
+    }
+    *state = longRow->checkpoints[index - 1].state;
+    return longRow->checkpoints[index - 1].at;
+}
+
+// Replaces the checkpoints of the long row from `start` up to `end` with a 
+// single one.
+void longRowReplaceCheckpoints(struct LongRow *longRow, int start, int end, int at, struct HighlightState *state) {
+    if (start == end && longRow->checkpointAmt == longRow->checkpointCapacity) {
+        longRow->checkpointCapacity = (longRow->checkpointCapacity > 0)? longRow->checkpointCapacity * 2 : 16;
+        longRow->checkpoints = realloc(longRow->checkpoints, 
+            longRow->checkpointCapacity * sizeof(struct HighlightCheckpoint));
+        if (longRow->checkpoints == NULL) {
+            die("realloc");
+        }
+    }
+    memmove(&longRow->checkpoints[start + 1], &longRow->checkpoints[end], 
+        (longRow->checkpointAmt - end) * sizeof(struct HighlightCheckpoint));
+    longRow->checkpointAmt += 1 - (end - start);
+
+    longRow->checkpoints[start] = (struct HighlightCheckpoint){ .at = at, .state = *state, .afterEdit = false };
+}
+
+// Updates the checkpoints of a long row after `delta` characters were inserted 
+// at index `at`, or `-delta` were deleted from there. The ones in and just 
+// before the edited part are dropped, since the highlighter might have looked 
+// at it to get to them. The ones after it are kept, out of date, to compare 
+// against when rehighlighting.
+void longRowTextChanged(struct TextRow *row, int at, int delta) {
+    struct LongRow *longRow = row->longRow;
+    int editEnd = (delta < 0)? at - delta : at;
+
+    int start = longRowFindCheckpoint(longRow, at - editorHighlightLookahead(), longRow->checkpointAmt);
+    int end = start;
+    while (end < longRow->checkpointAmt && longRow->checkpoints[end].at < editEnd) {
+        end++;
+    }
+    memmove(&longRow->checkpoints[start], &longRow->checkpoints[end], 
+        (longRow->checkpointAmt - end) * sizeof(struct HighlightCheckpoint));
+    longRow->checkpointAmt -= end - start;
+
+    for (int i = start; i < longRow->checkpointAmt; ++i) {
+        longRow->checkpoints[i].at += delta;
+    }
+    if (start < longRow->checkpointAmt) {
+        longRow->checkpoints[start].afterEdit = true;
+    }
+    if (longRow->validAmt > start) {
+        longRow->validAmt = start;
+    }
+
+    int columnAmt = at / TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING + 1;
+    if (longRow->columnAmt > columnAmt) {
+        longRow->columnAmt = columnAmt;
+    }
+}
+
+// Highlights the long row from index `at`, a token boundary where the 
+// highlighter was in `state`, up to the first boundary at or past `stop`, 
+// which is returned. `*text` and `*hl` are set to the row's characters and 
+// their highlighting from `at` onwards, in buffers that are reused by the 
+// next call.
+int longRowHighlight(struct TextRow *row, int at, int stop, const char **text, 
+    unsigned char **hl, struct HighlightState *state) {
+    static char *textScratch = NULL;
+    static unsigned char *hlScratch = NULL;
+    static int scratchSize = 0;
+
+    if (stop > row->size) {
+        stop = row->size;
+    }
+    int end = stop + editorHighlightLookahead();
+    if (end > row->size) {
+        end = row->size;
+    }
+    int len = end - at;
+    if (len > scratchSize) {
+        scratchSize = len;
+        textScratch = realloc(textScratch, scratchSize);
+        hlScratch = realloc(hlScratch, scratchSize);
+        if (textScratch == NULL || hlScratch == NULL) {
+            die("realloc");
+        }
+    }
+    editorRowCopyChars(row, at, len, textScratch);
+    *text = textScratch;
+    *hl = hlScratch;
+
+    return at + editorHighlightScan(textScratch, len, 0, stop - at, hlScratch, state);
+}
+
+// Brings the checkpoints of the long row up to date up to index `upTo`, 
+// adding one every TERMINAL_EDITOR_HL_CHECKPOINT_SPACING bytes or so. After 
+// an edit, it rehighlights until it ends up in the same state as before at 
+// an out of date checkpoint, from where on the ones up to the next edited 
+// part are known to be right again.
+void longRowValidate(struct TextRow *row, int upTo) {
+    struct LongRow *longRow = row->longRow;
+    const char *text;
+    unsigned char *hl;
+
+    while (true) {
+        struct HighlightState state;
+        int at = longRowStateBefore(longRow, longRow->validAmt, &state);
+        if (at >= upTo || at >= row->size || state.inLineComment) {
+            return;
+        }
+
+        int next = longRow->validAmt;
+        int stop = at + TERMINAL_EDITOR_HL_CHECKPOINT_SPACING;
+        if (next < longRow->checkpointAmt && longRow->checkpoints[next].at < stop) {
+            stop = longRow->checkpoints[next].at;
+        }
+        int boundary = longRowHighlight(row, at, stop, &text, &hl, &state);
+
+        int passed = next;
+        while (passed < longRow->checkpointAmt && longRow->checkpoints[passed].at < boundary) {
+            passed++;
+        }
+        if (passed < longRow->checkpointAmt && longRow->checkpoints[passed].at == boundary) {
+            if (highlightStatesEqual(&longRow->checkpoints[passed].state, &state)) {
+                longRowReplaceCheckpoints(longRow, next, passed + 1, boundary, &state);
+                longRow->validAmt = next + 1;
+                while (longRow->validAmt < longRow->checkpointAmt 
+                    && !longRow->checkpoints[longRow->validAmt].afterEdit) {
+                    longRow->validAmt++;
+                }
+                continue;
+            }
+            passed++;
+        }
+        longRowReplaceCheckpoints(longRow, next, passed, boundary, &state);
+        longRow->validAmt = next + 1;
+
+        // The next one was made from a checkpoint that was just replaced.
+        if (next + 1 < longRow->checkpointAmt) {
+            longRow->checkpoints[next + 1].afterEdit = true;
+        }
+    }
+}
+
+// Sets whether the long row starts inside a multi-line comment. When that 
+// changes its checkpoints are out of date, but they are still compared 
+// against since the highlighting usually gets back in step quickly.
+void longRowSetStart(struct TextRow *row, bool startsInComment) {
+    struct LongRow *longRow = row->longRow;
+    if (longRow->startsInComment != startsInComment) {
+        longRow->startsInComment = startsInComment;
+        longRow->validAmt = 0;
+    }
+}
+
+// Returns whether the long row ends inside a multi-line comment when it 
+// starts inside one if `startsInComment` is set.
+bool longRowEndsInComment(struct TextRow *row, bool startsInComment) {
+    longRowSetStart(row, startsInComment);
+    longRowValidate(row, row->size);
+
+    struct HighlightState state;
+    longRowStateBefore(row->longRow, row->longRow->validAmt, &state);
+    return state.inComment;
+}
+
+// Returns the column that the characters of the long row from index `at` up 
+// to `end` end at when rendered starting from column `column`.
+int longRowColumnAfter(struct TextRow *row, int at, int end, int column) {
+    struct LongRow *longRow = row->longRow;
+    while (at < end) {
+        // Walk the characters before and after the gap separately.
+        int pieceEnd = (at < longRow->gapStart && longRow->gapStart < end)? longRow->gapStart : end;
+        const char *s = &row->chars[(at >= longRow->gapStart)? at + longRow->gapLen : at];
+        const char *pieceStop = s + (pieceEnd - at);
+
+        const char *tab;
+        while ((tab = memchr(s, '\t', pieceStop - s)) != NULL) {
+            column += tab - s;
+            column += TERMINAL_EDITOR_TAB_SIZE - column % TERMINAL_EDITOR_TAB_SIZE;
+            s = tab + 1;
+        }
+        column += pieceStop - s;
+        at = pieceEnd;
+    }
+    return column;
+}
+
+// Brings the column checkpoints of the long row up to date up to the one 
+// for character index `at`, or the last one in the row.
+void longRowUpdateColumns(struct TextRow *row, int at) {
+    struct LongRow *longRow = row->longRow;
+    int needed = at / TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING + 1;
+    int lastNeeded = row->size / TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING + 1;
+    if (needed > lastNeeded) {
+        needed = lastNeeded;
+    }
+    if (needed <= longRow->columnAmt) {
+        return;
+    }
+    if (needed > longRow->columnCapacity) {
+        longRow->columnCapacity = lastNeeded + lastNeeded / 8 + 1;
+        longRow->columns = realloc(longRow->columns, longRow->columnCapacity * sizeof(int));
+        if (longRow->columns == NULL) {
+            die("realloc");
+        }
+    }
+    if (longRow->columnAmt == 0) {
+        longRow->columns[longRow->columnAmt++] = 0;
+    }
+    while (longRow->columnAmt < needed) {
+        int from = (longRow->columnAmt - 1) * TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING;
+        longRow->columns[longRow->columnAmt] = longRowColumnAfter(row, from, 
+            from + TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING, longRow->columns[longRow->columnAmt - 1]);
+        longRow->columnAmt++;
+    }
+}
+
+// Converts a character index of a long row to a rendered column, like 
+// `editorCursorXRealToRender`.
+int longRowRealToRender(struct TextRow *row, int cursorX) {
+    struct LongRow *longRow = row->longRow;
+    if (longRow->tabAmt == 0) {
+        return cursorX;
+    }
+    longRowUpdateColumns(row, cursorX);
+    int index = cursorX / TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING;
+    int at = index * TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING;
+    return longRowColumnAfter(row, at, cursorX, longRow->columns[index]);
+}
+
+// Converts a rendered column of a long row to a character index, like 
+// `editorRenderCursorXToReal`.
+int longRowRenderToReal(struct TextRow *row, int renderCursorX) {
+    struct LongRow *longRow = row->longRow;
+    if (longRow->tabAmt == 0) {
+        return (renderCursorX < row->size)? renderCursorX : row->size;
+    }
+
+    // Find the last checkpoint at or before the column, bringing them up to 
+    // date until one past it shows up.
+    longRowUpdateColumns(row, 0);
+    while (longRow->columns[longRow->columnAmt - 1] <= renderCursorX 
+        && (longRow->columnAmt - 1) * TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING + TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING <= row->size) {
+        longRowUpdateColumns(row, longRow->columnAmt * TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING);
+    }
+    int low = 0;
+    int high = longRow->columnAmt;
+    while (high - low > 1) {
+        int mid = low + (high - low) / 2;
+        if (longRow->columns[mid] <= renderCursorX) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    int currRenderCursorX = longRow->columns[low];
+    for (int cursorX = low * TERMINAL_EDITOR_COLUMN_CHECKPOINT_SPACING; cursorX < row->size; ++cursorX) {
+        if (editorRowCharAt(row, cursorX) == '\t') {
+            currRenderCursorX += (TERMINAL_EDITOR_TAB_SIZE - 1) - (currRenderCursorX % TERMINAL_EDITOR_TAB_SIZE);
+        }
+        currRenderCursorX++;
+
+        if (currRenderCursorX > renderCursorX) {
+            return cursorX;
+        }
+    }
+    return row->size;
+}
+
+/*
+ * Row operations
+ */
+
+// Converts an index into the row's real backing character array 
+// `row.chars` into an index into the row's rendereed character array 
+// `row.render`.
+int editorCursorXRealToRender(struct TextRow *row, int cursorX) {
+    if (row->longRow != NULL) {
+        return longRowRealToRender(row, cursorX);
+    }
+    int renderCursorX = 0;
+    
+    for (int i = 0; i < cursorX; i++) {
+        if (row->chars[i] == '\t') {
+            renderCursorX += (TERMINAL_EDITOR_TAB_SIZE - 1) - (renderCursorX % TERMINAL_EDITOR_TAB_SIZE);
+        }
+        renderCursorX++;
+    }
+    return renderCursorX;
+}
+
+// Does the same thing as `editorCursorXRealToRender` but in the other 
+// direction where it turns a `row.render` index into a `row.chars` index.
+int editorRenderCursorXToReal(struct TextRow *row, int renderCursorX) {
+    if (row->longRow != NULL) {
+        return longRowRenderToReal(row, renderCursorX);
+    }
+    int currRenderCursorX = 0;
+    
+    for (int cursorX = 0; cursorX < row->size; ++cursorX) {
+        if (row->chars[cursorX] == '\t') {
+            currRenderCursorX += (TERMINAL_EDITOR_TAB_SIZE - 1) - (currRenderCursorX % TERMINAL_EDITOR_TAB_SIZE);
+        }
+        currRenderCursorX++;
+
+        if (currRenderCursorX > renderCursorX) {
+            return cursorX;
+        }
+    }
+    return row->size;
+}
+
+// Builds the row's `render` array by expanding the tabs in `chars`. Rows 
+// without tabs don't get one.
+void editorRenderRow(struct TextRow *row) {
+    int tabAmt = textCountTabs(row->chars, row->size);
+
+    free(row->render);
+    row->render = NULL;
+    row->renderSize = row->size;
+    row->renderValid = true;
+    if (tabAmt == 0) {
+        return;
+    }
+    row->render = malloc(row->size + tabAmt*(TERMINAL_EDITOR_TAB_SIZE - 1) + 1);
+
+    int renderIdx = 0;
+
+    for (int i = 0; i < row->size; i++) {
+        // Simulate tab spacing by adding spaces until the row index is a 
+        // multiple of the tab size.
+        if (row->chars[i] == '\t') {
+            row->render[renderIdx++] = ' ';
+            while (renderIdx % TERMINAL_EDITOR_TAB_SIZE != 0) {
+                row->render[renderIdx++] = ' ';
+            }
+        }
+        else {
+            row->render[renderIdx++] = row->chars[i];
+        }
+    }
+    row->render[renderIdx] = '\0';
+    row->renderSize = renderIdx;
+}
+
+// Returns the row's rendered characters, which are its `chars` when it has 
+// no tabs. `render` must be up to date.
+const char *editorRowRenderChars(struct TextRow *row) {
+    return (row->render != NULL)? row->render : row->chars;
+}
+
+// Returns the row at `fileRow` (or NULL if there is no such row) after making 
+// sure that its `render` and `highlight` arrays are up to date.
+struct TextRow *editorRowRendered(int fileRow) {
+    struct TextRow *row = editorRowAt(fileRow);
+    if (row == NULL) {
+        return NULL;
+    }
+
+    // A row's highlighting depends on whether the row before it ends inside 
+    // a multi-line comment.
+    bool startsInComment = false;
+    if (editorSyntaxHasMultiLineState()) {
+        editorSyncSyntaxState(fileRow);
+
+        struct TextRow *prevRow = editorRowAt(fileRow - 1);
+        startsInComment = (prevRow != NULL && prevRow->partOfMultiLineComment);
+    }
+
+    // Long rows are rendered and highlighted as they are drawn.
+    editorRowCheckLong(row);
+    if (row->longRow != NULL) {
+        longRowSetStart(row, startsInComment);
+    }
+    else if (!row->highlightValid || row->startsInMultiLineComment != startsInComment) {
+        if (!row->renderValid) {
+            editorRenderRow(row);
+        }
+        editorUpdateSyntax(row, startsInComment);
+    }
+
+    if (editor.syntaxStateEnd == fileRow) {
+        editorSyncSyntaxState(fileRow + 1);
+    }
+    return row;
+}
+
+// Marks the row's `render` and `highlight` arrays as outdated after `delta` 
+// characters were inserted into its `chars` at `at`, or removed from there 
+// when negative. They are rebuilt once the row is drawn again.
+void editorUpdateRow(int fileRow, int at, int delta) {
+    struct TextRow *row = editorRowAt(fileRow);
+    row->renderValid = false;
+    row->highlightValid = false;
+    row->multiLineStateValid = false;
+    editorInvalidateSyntaxState(fileRow);
+    editorSearchRowChanged(fileRow, at, delta);
+}
+
+// Inserts a new row at index `at` that takes over `chars` as its content. 
+// When `mapped` is set, `chars` points into the file's loaded contents.
+void editorInsertRowChars(int at, char *chars, size_t len, bool mapped) {
+    editorRecordEdit(EDIT_INSERT_ROW, at, 0, chars, len);
+
+    struct TextRow row;
+
+    row.size = len;
+    row.chars = chars;
+    row.charsMapped = mapped;
+    row.longRow = NULL;
+    row.charsEpoch = editor.charsEpoch;
+
+    row.renderSize = 0;
+    row.render = NULL;
+    row.highlight = NULL;
+
+    row.renderValid = false;
+    row.highlightValid = false;
+    row.partOfMultiLineComment = false;
+    row.startsInMultiLineComment = false;
+    row.multiLineStateValid = false;
+
+    // Rows are long from the start when they are created long enough, so 
+    // that searching never has to turn them into long rows.
+    editorRowCheckLong(&row);
+
+    rowTreeInsert(at, &row);
+    editor.rowAmt++;
+    editorSearchRowInserted(at);
+
+    if (editor.load.active && at <= editor.load.nextRow) {
+        editor.load.nextRow++;
+    }
+
+    // The new row is only rendered once it is drawn. The rows after it might 
+    // now start inside or outside a multi-line comment.
+    editorInvalidateSyntaxState(at);
+    if (at < editor.syntaxStateHighWater) {
+        editor.syntaxStateHighWater++;
+    }
+
+    editor.version++;
+}
+
+void editorInsertRow(int at, char *s, size_t len) {
+    if (at < 0 || at > editor.rowAmt) {
+        return;
+    }
+
+    char *chars = malloc(len + 1);
+    memcpy(chars, s, len);
+    chars[len] = '\0';
+
+    editorInsertRowChars(at, chars, len, false);
+}
+
+// Whether the row's `chars` is part of the snapshot a background save is 
+// writing out.
+bool editorRowCharsFrozen(struct TextRow *row) {
+    return editor.save.active && !row->charsMapped && row->charsEpoch < editor.save.epoch;
+}
+
+// Frees a `chars` buffer, or hands it to the background save to be freed 
+// once it is done with it.
+void editorFreeRowChars(struct TextRow *row) {
+    if (row->charsMapped) {
+        return;
+    }
+    if (editorRowCharsFrozen(row)) {
+        struct SaveJob *save = &editor.save;
+        if (save->garbageAmt == save->garbageCapacity) {
+            save->garbageCapacity = (save->garbageCapacity > 0)? save->garbageCapacity * 2 : 64;
+            save->garbage = realloc(save->garbage, save->garbageCapacity * sizeof(char *));
+            if (save->garbage == NULL) {
+                die("realloc");
+            }
+        }
+        save->garbage[save->garbageAmt++] = row->chars;
+        return;
+    }
+    free(row->chars);
+}
+
+// Gives the row its own copy of `chars` if it still points into the memory 
+// mapped file or is being written out by a background save. Must be called 
+// before modifying `chars`.
+void editorRowOwnChars(struct TextRow *row) {
+    if (!row->charsMapped && !editorRowCharsFrozen(row)) {
+        return;
+    }
+    char *chars = malloc(row->size + 1);
+    editorRowCopyChars(row, 0, row->size, chars);
+    chars[row->size] = '\0';
+
+    editorFreeRowChars(row);
+    row->chars = chars;
+    row->charsMapped = false;
+    row->charsEpoch = editor.charsEpoch;
+
+    // The copy is made without a gap.
+    if (row->longRow != NULL) {
+        row->longRow->gapStart = row->size;
+        row->longRow->gapLen = 0;
+    }
+}
+
+void editorFreeRow(struct TextRow *row) {
+    free(row->render);
+    editorFreeRowChars(row);
+    free(row->highlight);
+    if (row->longRow != NULL) {
+        free(row->longRow->checkpoints);
+        free(row->longRow->columns);
+        free(row->longRow);
+    }
+}
+
+void editorDeleteRow(int at) {
+    if (at < 0 || at >= editor.rowAmt) {
+        return;
+    }
+    struct TextRow row;
+    rowTreeDelete(at, &row);
+    editorRecordEdit(EDIT_DELETE_ROW, at, 0, editorRowChars(&row), row.size);
+    editorFreeRow(&row);
+
+    editor.rowAmt--;
+    editorSearchRowDeleted(at);
+
+    if (editor.load.active && at < editor.load.nextRow) {
+        editor.load.nextRow--;
+    }
+
+    editorInvalidateSyntaxState(at);
+    if (at < editor.syntaxStateHighWater) {
+        editor.syntaxStateHighWater--;
+    }
+    editor.version++;
+}
+
+// Inserts the `len` bytes of `s` into the row before index `at`, or at the 
+// end of the row when `at` is out of bounds.
+void editorInsertStringIntoRow(int fileRow, int at, const char *s, size_t len) {
+    struct TextRow *row = editorRowAt(fileRow);
+
+    if (at < 0 || at > row->size) {
+        at = row->size;
+    }
+    if (len == 0) {
+        return;
+    }
+    editorRecordEdit(EDIT_INSERT_TEXT, fileRow, at, s, len);
+
+    if (row->longRow == NULL && row->size + len >= TERMINAL_EDITOR_LONG_ROW_SIZE) {
+        editorRowMakeLong(row);
+    }
+    if (row->longRow != NULL) {
+        // Insert the text at the start of the gap.
+        struct LongRow *longRow = row->longRow;
+        longRowMoveGap(row, at, len);
+        memcpy(&row->chars[at], s, len);
+        longRow->gapStart += len;
+        longRow->gapLen -= len;
+        longRow->tabAmt += textCountTabs(s, len);
+        longRowTextChanged(row, at, len);
+    }
+    else {
+        editorRowOwnChars(row);
+
+        row->chars = realloc(row->chars, row->size + len + 1);
+
+        // Move the portion of the row at/after `at` by `len` to make room for 
+        // inserting `s` at `row->chars[at]`. 
+        memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+        memcpy(&row->chars[at], s, len);
+    }
+
+    row->size += len;
+    rowTreeResize(fileRow, len);
+    editorUpdateRow(fileRow, at, len);
+    editor.version++;
+}
+
+void editorInsertCharIntoRow(int fileRow, int at, int ch) {
+    char c = ch;
+    editorInsertStringIntoRow(fileRow, at, &c, 1);
+}
+
+void editorAppendStringToRow(int fileRow, char *s, size_t len) {
+    editorInsertStringIntoRow(fileRow, editorRowAt(fileRow)->size, s, len);
+}
+
+// Deletes up to `len` characters from the row, starting at index `at`.
+void editorDeleteStringFromRow(int fileRow, int at, int len) {
+    struct TextRow *row = editorRowAt(fileRow);
+
+    if (at < 0 || at >= row->size) {
+        return;
+    }
+    if (len > row->size - at) {
+        len = row->size - at;
+    }
+    if (len <= 0) {
+        return;
+    }
+    editorRowCheckLong(row);
+    if (row->longRow != NULL) {
+        // Grow the gap over the deleted characters, which follow it.
+        struct LongRow *longRow = row->longRow;
+        longRowMoveGap(row, at, 0);
+        char *deleted = &row->chars[at + longRow->gapLen];
+        editorRecordEdit(EDIT_DELETE_TEXT, fileRow, at, deleted, len);
+        longRow->tabAmt -= textCountTabs(deleted, len);
+        longRow->gapLen += len;
+        longRowTextChanged(row, at, -len);
+    }
+    else {
+        editorRecordEdit(EDIT_DELETE_TEXT, fileRow, at, &row->chars[at], len);
+        editorRowOwnChars(row);
+
+        // Shift everything after the deleted characters back over them.
+        memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    }
+    row->size -= len;
+    rowTreeResize(fileRow, -len);
+    editorUpdateRow(fileRow, at, -len);
+    editor.version++;
+}
+
+void editorDeleteCharFromRow(int fileRow, int at) {
+    editorDeleteStringFromRow(fileRow, at, 1);
+}
+
+/*
+ * Editor operations.
+ */
+
+void editorInsertChar(int ch) {
+    if (editor.cursorY == editor.rowAmt) {
+        editorInsertRow(editor.rowAmt, "", 0);
+    }
+    editorInsertCharIntoRow(editor.cursorY, editor.cursorX, ch);
+    editor.cursorX++;
+}
+
+void editorInsertNewline() {
+    // We are at the start of a line, we can just add a new empty line.
+    if (editor.cursorX == 0) {
+        editorInsertRow(editor.cursorY, "", 0);
+    }
+    // We are pressing ENTER in the middle of an existing line, therefore 
+    // we must split it along where the cursor's X position is.
+    else {
+        struct TextRow *row = editorRowAt(editor.cursorY);
+        editorInsertRow(editor.cursorY + 1, editorRowCharsFrom(row, editor.cursorX), row->size - editor.cursorX);
+
+        // Reassign the row as it might have been invalidated by the call to 
+        // `editorInsertRow`.
+        row = editorRowAt(editor.cursorY);
+        editorDeleteStringFromRow(editor.cursorY, editor.cursorX, row->size - editor.cursorX);
+    }
+    editor.cursorY++;
+    editor.cursorX = 0;
+}
+
+void editorDelChar() {
+    if (editor.cursorY == editor.rowAmt) {
+        return;
+    }
+    if (editor.cursorX == 0 && editor.cursorY == 0) {
+        return;
+    }
+
+    struct TextRow *row = editorRowAt(editor.cursorY);
+    if (editor.cursorX > 0) {
+        editorDeleteCharFromRow(editor.cursorY, editor.cursorX - 1);
+        editor.cursorX--;
+    }
+    else {
+        editor.cursorX = editorRowAt(editor.cursorY - 1)->size;
+        editorAppendStringToRow(editor.cursorY - 1, editorRowChars(row), row->size);
+        editorDeleteRow(editor.cursorY);
+        editor.cursorY--;
+    }
+}
+
+// Returns the offset of the first line break ('\r' or '\n') in `text` at or 
+// after `from`, or `len` if there is none.
+size_t textFindLineBreak(const char *text, size_t from, size_t len) {
+    while (from < len && text[from] != '\r' && text[from] != '\n') {
+        from++;
+    }
+    return from;
+}
+
+// Returns the offset past the line break at `at`, "\r\n" counting as one.
+size_t textSkipLineBreak(const char *text, size_t at, size_t len) {
+    if (text[at] == '\r' && at + 1 < len && text[at + 1] == '\n') {
+        return at + 2;
+    }
+    return at + 1;
+}
+
+// Inserts a block of text, such as a paste, at the cursor and moves the 
+// cursor past it. The row at the cursor is split in two around the text, 
+// and each of the text's lines in between becomes a row of its own, so the 
+// cost does not depend on how the text would be typed in.
+void editorInsertText(const char *text, size_t len) {
+    if (editor.cursorY == editor.rowAmt) {
+        editorInsertRow(editor.rowAmt, "", 0);
+    }
+    size_t lineEnd = textFindLineBreak(text, 0, len);
+    if (lineEnd == len) {
+        editorInsertStringIntoRow(editor.cursorY, editor.cursorX, text, len);
+        editor.cursorX += len;
+        return;
+    }
+    editorSearchBeginBatch();
+
+    // Move the part of the row after the cursor past the last line.
+    struct TextRow *row = editorRowAt(editor.cursorY);
+    struct AppendBuf lastLine = NEW_APPEND_BUF;
+    int tailLen = row->size - editor.cursorX;
+    char *tail = malloc(tailLen + 1);
+    memcpy(tail, editorRowCharsFrom(row, editor.cursorX), tailLen);
+
+    editorDeleteStringFromRow(editor.cursorY, editor.cursorX, tailLen);
+    editorInsertStringIntoRow(editor.cursorY, editor.cursorX, text, lineEnd);
+
+    int at = editor.cursorY;
+    size_t lineStart = textSkipLineBreak(text, lineEnd, len);
+    while ((lineEnd = textFindLineBreak(text, lineStart, len)) < len) {
+        editorInsertRow(++at, (char *)&text[lineStart], lineEnd - lineStart);
+        lineStart = textSkipLineBreak(text, lineEnd, len);
+    }
+
+    bufAppend(&lastLine, &text[lineStart], len - lineStart);
+    editor.cursorX = lastLine.len;
+    bufAppend(&lastLine, tail, tailLen);
+    editorInsertRow(++at, (lastLine.len > 0)? lastLine.buf : "", lastLine.len);
+    editor.cursorY = at;
+    editorSearchEndBatch();
+
+    freeAppendBuf(&lastLine);
+    free(tail);
+}
+
+/*
+ * Undo log.
+ *
+ * Edits are recorded as the primitive row operations they are made of, and 
+ * undone by applying the opposite operations in reverse order. Typing and 
+ * deleting runs of characters, as well as everything done by keys that 
+ * arrive in a burst, like a paste, make up a single undo step.
+ */
+
+size_t undoMemoryUsage(struct UndoLog *log) {
+    return log->text.len 
+        + log->entryAmt * sizeof(struct UndoEntry) 
+        + log->groupAmt * sizeof(struct UndoGroup);
+}
+
+// Index of the first entry past the given group.
+int undoGroupEnd(struct UndoLog *log, int group) {
+    return (group + 1 < log->groupAmt)? log->groups[group + 1].firstEntry : log->entryAmt;
+}
+
+// Forgets the groups from `group` onwards, along with their entries and text.
+void undoTruncate(struct UndoLog *log, int group) {
+    if (group >= log->groupAmt) {
+        return;
+    }
+    int firstEntry = log->groups[group].firstEntry;
+    if (firstEntry < log->entryAmt) {
+        log->text.len = log->entries[firstEntry].text;
+    }
+    log->entryAmt = firstEntry;
+    log->groupAmt = group;
+    if (log->doneAmt > group) {
+        log->doneAmt = group;
+    }
+    log->open = false;
+}
+
+// Forgets the oldest `amt` groups, along with their entries and text.
+void undoDropOldest(struct UndoLog *log, int amt) {
+    if (amt >= log->groupAmt) {
+        log->entryAmt = 0;
+        log->groupAmt = 0;
+        log->doneAmt = 0;
+        log->text.len = 0;
+        log->open = false;
+        return;
+    }
+    int entryAmt = log->groups[amt].firstEntry;
+    size_t textLen = (entryAmt < log->entryAmt)? log->entries[entryAmt].text : log->text.len;
+
+    memmove(log->entries, &log->entries[entryAmt], (log->entryAmt - entryAmt) * sizeof(struct UndoEntry));
+    log->entryAmt -= entryAmt;
+    for (int i = 0; i < log->entryAmt; ++i) {
+        log->entries[i].text -= textLen;
+    }
+
+    memmove(log->groups, &log->groups[amt], (log->groupAmt - amt) * sizeof(struct UndoGroup));
+    log->groupAmt -= amt;
+    for (int i = 0; i < log->groupAmt; ++i) {
+        log->groups[i].firstEntry -= entryAmt;
+    }
+    log->doneAmt = (log->doneAmt > amt)? log->doneAmt - amt : 0;
+
+    memmove(log->text.buf, &log->text.buf[textLen], log->text.len - textLen);
+    log->text.len -= textLen;
+}
+
+// Ends the open group, if there is one, so the next edit starts a new undo 
+// step. Old undo steps are dropped if the log takes too much memory. They 
+// are dropped a quarter of the budget at a time, so the cost of moving the 
+// rest of the log is spread over many steps.
+void undoCloseGroup(struct UndoLog *log) {
+    if (!log->open) {
+        return;
+    }
+    struct UndoGroup *group = &log->groups[log->groupAmt - 1];
+    group->afterCursorX = editor.cursorX;
+    group->afterCursorY = editor.cursorY;
+    log->open = false;
+
+    if (undoMemoryUsage(log) <= TERMINAL_EDITOR_UNDO_MAX_BYTES) {
+        return;
+    }
+    int amt = 0;
+    size_t freed = 0;
+    while (amt < log->groupAmt && undoMemoryUsage(log) - freed > TERMINAL_EDITOR_UNDO_MAX_BYTES / 4 * 3) {
+        int end = undoGroupEnd(log, amt);
+        size_t textEnd = (end < log->entryAmt)? log->entries[end].text : log->text.len;
+        size_t textStart = (log->groups[amt].firstEntry < log->entryAmt)? 
+            log->entries[log->groups[amt].firstEntry].text : textEnd;
+
+        freed += textEnd - textStart 
+            + (end - log->groups[amt].firstEntry) * sizeof(struct UndoEntry) 
+            + sizeof(struct UndoGroup);
+        amt++;
+    }
+    undoDropOldest(log, amt);
+}
+
+// Records an edit of the buffer into the open group, starting a new one if 
+// needed. Typing into a row extends the last recorded insertion when it 
+// continues it.
+void undoRecord(enum EditOp op, int fileRow, int col, const char *text, int len) {
+    struct UndoLog *log = &editor.undo;
+    if (log->paused) {
+        return;
+    }
+    // A new edit makes the undone steps impossible to redo.
+    undoTruncate(log, log->doneAmt);
+
+    if (!log->open) {
+        if (log->groupAmt == log->groupCapacity) {
+            log->groupCapacity = (log->groupCapacity > 0)? log->groupCapacity * 2 : 64;
+            log->groups = realloc(log->groups, log->groupCapacity * sizeof(struct UndoGroup));
+            if (log->groups == NULL) {
+                die("realloc");
+            }
+        }
+        struct UndoGroup *group = &log->groups[log->groupAmt++];
+        group->firstEntry = log->entryAmt;
+        group->cursorX = editor.cursorX;
+        group->cursorY = editor.cursorY;
+        log->doneAmt = log->groupAmt;
+        log->open = true;
+    }
+
+    int firstEntry = log->groups[log->groupAmt - 1].firstEntry;
+    if (op == EDIT_INSERT_TEXT && log->entryAmt > firstEntry) {
+        struct UndoEntry *last = &log->entries[log->entryAmt - 1];
+        if (last->op == EDIT_INSERT_TEXT && last->row == fileRow && last->col + last->len == col) {
+            bufAppend(&log->text, text, len);
+            last->len += len;
+            return;
+        }
+    }
+
+    if (log->entryAmt == log->entryCapacity) {
+        log->entryCapacity = (log->entryCapacity > 0)? log->entryCapacity * 2 : 256;
+        log->entries = realloc(log->entries, log->entryCapacity * sizeof(struct UndoEntry));
+        if (log->entries == NULL) {
+            die("realloc");
+        }
+    }
+    struct UndoEntry *entry = &log->entries[log->entryAmt++];
+    entry->op = op;
+    entry->row = fileRow;
+    entry->col = col;
+    entry->len = len;
+    entry->text = log->text.len;
+    bufAppend(&log->text, text, len);
+}
+
+// Decides whether the key that is about to be processed starts a new undo 
+// step or continues the last one.
+void undoStartKey(struct UndoLog *log, int ch) {
+    enum UndoKeyKind kind = UNDO_KEY_OTHER;
+    if (ch == BACKSPACE || ch == CTRL_KEY('h') || ch == DEL_KEY) {
+        kind = UNDO_KEY_DELETING;
+    }
+    else if (ch == '\t' || (!iscntrl(ch) && ch < 128)) {
+        kind = UNDO_KEY_TYPING;
+    }
+
+    if (!log->burst && (kind == UNDO_KEY_OTHER || kind != log->lastKind)) {
+        undoCloseGroup(log);
+    }
+    log->lastKind = kind;
+}
+
+// Records whether more input is waiting after a key was processed.
+void undoEndKey(struct UndoLog *log) {
+    log->burst = editorInputPending();
+}
+
+// Applies a primitive edit to the buffer.
+void editorApplyEdit(enum EditOp op, int fileRow, int col, const char *text, int len) {
+    switch (op) {
+        case EDIT_INSERT_TEXT:
+            editorInsertStringIntoRow(fileRow, col, text, len);
+            break;
+        case EDIT_DELETE_TEXT:
+            editorDeleteStringFromRow(fileRow, col, len);
+            break;
+        case EDIT_INSERT_ROW:
+            editorInsertRow(fileRow, (char *)text, len);
+            break;
+        case EDIT_DELETE_ROW:
+            editorDeleteRow(fileRow);
+            break;
+    }
+}
+
+void undoApplyEntry(struct UndoLog *log, struct UndoEntry *entry, bool revert) {
+    enum EditOp op = revert? (entry->op ^ 1) : entry->op;
+    editorApplyEdit(op, entry->row, entry->col, &log->text.buf[entry->text], entry->len);
+}
+
+void editorMoveCursorTo(int cursorX, int cursorY) {
+    if (cursorY < 0) {
+        cursorY = 0;
+    }
+    editor.cursorY = (cursorY <= editor.rowAmt)? cursorY : editor.rowAmt;
+
+    struct TextRow *row = editorRowAt(editor.cursorY);
+    int rowLen = (row != NULL)? row->size : 0;
+    if (cursorX < 0) {
+        cursorX = 0;
+    }
+    editor.cursorX = (cursorX <= rowLen)? cursorX : rowLen;
+}
+
+// Reverts the last undo step, or applies the last undone step again when 
+// `redo` is set. All the edits of a step are applied at once, and the 
+// screen is only drawn after the last one.
+void editorUndo(bool redo) {
+    struct UndoLog *log = &editor.undo;
+    undoCloseGroup(log);
+
+    if ((redo && log->doneAmt == log->groupAmt) || (!redo && log->doneAmt == 0)) {
+        editorSetStatusMessage(redo? "Nothing to redo" : "Nothing to undo");
+        return;
+    }
+    int groupIndex = redo? log->doneAmt : log->doneAmt - 1;
+    struct UndoGroup *group = &log->groups[groupIndex];
+    int end = undoGroupEnd(log, groupIndex);
+
+    log->paused = true;
+    editorSearchBeginBatch();
+    if (redo) {
+        for (int i = group->firstEntry; i < end; ++i) {
+            undoApplyEntry(log, &log->entries[i], false);
+        }
+        editorMoveCursorTo(group->afterCursorX, group->afterCursorY);
+        log->doneAmt++;
+    }
+    else {
+        for (int i = end - 1; i >= group->firstEntry; --i) {
+            undoApplyEntry(log, &log->entries[i], true);
+        }
+        editorMoveCursorTo(group->cursorX, group->cursorY);
+        log->doneAmt--;
+    }
+    editorSearchEndBatch();
+    log->paused = false;
+
+    editorSetStatusMessage("%s %d edit%s", redo? "Redid" : "Undid", end - group->firstEntry, 
+        (end - group->firstEntry == 1)? "" : "s");
+}
+
+/*
+ * Journal.
+ *
+ * Each edit is appended to the journal as an operation byte, followed by its 
+ * row, column and text length as variable length integers, and the text. 
+ * Journaling an edit only appends a few bytes to a buffer, the journal file 
+ * is written in between keypresses and synced on a timer.
+ */
+
+// Returns the path of the journal of the file at `path`: a hidden file in 
+// the same directory.
+char *journalPathFor(const char *path) {
+    const char *slash = strrchr(path, '/');
+    int dirLen = (slash != NULL)? slash - path + 1 : 0;
+
+    size_t size = strlen(path) + 16;
+    char *journalPath = malloc(size);
+    snprintf(journalPath, size, "%.*s.%s.journal", dirLen, path, &path[dirLen]);
+    return journalPath;
+}
+
+// Fills in the header of a journal for the file at `path` in its current 
+// state.
+void journalMakeHeader(struct JournalHeader *header, const char *path) {
+    memset(header, 0, sizeof(struct JournalHeader));
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        header->fileSize = st.st_size;
+        header->mtimeSec = st.st_mtim.tv_sec;
+        header->mtimeNsec = st.st_mtim.tv_nsec;
+    }
+    else {
+        header->fileSize = -1;
+    }
+}
+
+// Notes that the journal file has bytes that are not synced yet, and 
+// schedules a sync if none is.
+void journalWritten(struct Journal *journal) {
+    if (!journal->unsynced) {
+        journal->unsynced = true;
+        timerArm(TIMER_JOURNAL_SYNC, TERMINAL_EDITOR_JOURNAL_SYNC_MS);
+    }
+}
+
+// Replaces the journal file with one that applies to the file as it is now 
+// on disk, and holds `len` bytes of edits from `records`.
+bool journalRewrite(struct Journal *journal, const char *records, size_t len) {
+    char *tmpPath;
+    int fd = saveOpenTempFileFor(journal->path, &tmpPath);
+    if (fd == -1) {
+        free(tmpPath);
+        return false;
+    }
+
+    struct JournalHeader header;
+    journalMakeHeader(&header, editor.filename);
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header) 
+        && (len == 0 || write(fd, records, len) == (ssize_t)len) 
+        && rename(tmpPath, journal->path) == 0;
+    if (!ok) {
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+
+    if (!ok) {
+        close(fd);
+        return false;
+    }
+    if (journal->fd != -1) {
+        close(journal->fd);
+    }
+    journal->fd = fd;
+    journal->size = len;
+    journalWritten(journal);
+    return true;
+}
+
+void journalAppendVarint(struct AppendBuf *aBuf, unsigned long value) {
+    char bytes[10];
+    int len = 0;
+    do {
+        bytes[len++] = (value & 0x7f) | ((value > 0x7f)? 0x80 : 0);
+        value >>= 7;
+    } while (value != 0);
+    bufAppend(aBuf, bytes, len);
+}
+
+// Reads a variable length integer from `buf` at `*at`. Returns false if it 
+// runs past `len`.
+bool journalReadVarint(const char *buf, size_t len, size_t *at, unsigned long *value) {
+    *value = 0;
+    for (int shift = 0; *at < len && shift < 64; shift += 7) {
+        unsigned char byte = buf[(*at)++];
+        *value |= (unsigned long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void journalRecord(struct Journal *journal, enum EditOp op, int fileRow, int col, const char *text, int len) {
+    if (journal->paused || editor.filename == NULL) {
+        return;
+    }
+    char opByte = op;
+    bufAppend(&journal->pending, &opByte, 1);
+    journalAppendVarint(&journal->pending, fileRow);
+    journalAppendVarint(&journal->pending, col);
+    journalAppendVarint(&journal->pending, len);
+    bufAppend(&journal->pending, text, len);
+}
+
+// Writes the journaled edits to the journal file, creating it if needed.
+void journalFlush(struct Journal *journal) {
+    if (journal->pending.len == 0) {
+        return;
+    }
+    if (journal->fd == -1) {
+        free(journal->path);
+        journal->path = journalPathFor(editor.filename);
+        if (!journalRewrite(journal, NULL, 0)) {
+            return;
+        }
+    }
+
+    size_t written = 0;
+    while (written < journal->pending.len) {
+        ssize_t amt = write(journal->fd, &journal->pending.buf[written], journal->pending.len - written);
+        if (amt == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += amt;
+    }
+    journal->size += written;
+    memmove(journal->pending.buf, &journal->pending.buf[written], journal->pending.len - written);
+    journal->pending.len -= written;
+
+    if (written > 0) {
+        journalWritten(journal);
+    }
+}
+
+// Syncs the journal file to disk, when its sync timer goes off.
+bool journalSync() {
+    struct Journal *journal = &editor.journal;
+    if (journal->unsynced && journal->fd != -1) {
+        fdatasync(journal->fd);
+    }
+    journal->unsynced = false;
+    return false;
+}
+
+// Notes where the journal ends when a background save takes its snapshot.
+void journalSaveStarted(struct Journal *journal) {
+    journal->saveOffset = journal->size + journal->pending.len;
+}
+
+// Drops the edits that were just saved from the journal, keeping the ones 
+// made while the save was running.
+void journalSaveDone(struct Journal *journal) {
+    // Edits that were never written to the journal file don't need to be.
+    if (journal->fd == -1) {
+        size_t saved = journal->saveOffset;
+        if (saved > journal->pending.len) {
+            saved = journal->pending.len;
+        }
+        memmove(journal->pending.buf, &journal->pending.buf[saved], journal->pending.len - saved);
+        journal->pending.len -= saved;
+        return;
+    }
+    journalFlush(journal);
+
+    size_t tailLen = (journal->size > journal->saveOffset)? journal->size - journal->saveOffset : 0;
+    char *tail = malloc(tailLen + 1);
+    off_t tailOffset = sizeof(struct JournalHeader) + journal->size - tailLen;
+    if (pread(journal->fd, tail, tailLen, tailOffset) == (ssize_t)tailLen) {
+        journalRewrite(journal, tail, tailLen);
+    }
+    free(tail);
+}
+
+// Removes the journal, once its edits are either saved or discarded.
+void journalRemove(struct Journal *journal) {
+    if (journal->fd == -1) {
+        return;
+    }
+    close(journal->fd);
+    unlink(journal->path);
+    journal->fd = -1;
+    journal->pending.len = 0;
+    journal->unsynced = false;
+}
+
+// Applies the edits of a journal to the buffer. Stops at the first edit that 
+// doesn't fit the buffer or was cut short. Returns the amount of bytes of 
+// edits that were applied, and their amount in `*amt`.
+size_t journalReplay(const char *records, size_t len, int *amt) {
+    size_t applied = 0;
+    *amt = 0;
+
+    while (applied < len) {
+        size_t at = applied;
+        unsigned char op = records[at++];
+        unsigned long fileRow, col, textLen;
+        if (op > EDIT_DELETE_ROW 
+            || !journalReadVarint(records, len, &at, &fileRow) 
+            || !journalReadVarint(records, len, &at, &col) 
+            || !journalReadVarint(records, len, &at, &textLen) 
+            || textLen > len - at) {
+            break;
+        }
+
+        // Rows can be inserted right past the last row, the other edits 
+        // need an existing row.
+        if (fileRow > (unsigned long)editor.rowAmt 
+            || (op != EDIT_INSERT_ROW && fileRow == (unsigned long)editor.rowAmt)) {
+            break;
+        }
+        if ((op == EDIT_INSERT_TEXT || op == EDIT_DELETE_TEXT) && col > (unsigned long)editorRowAt(fileRow)->size) {
+            break;
+        }
+        editorApplyEdit(op, fileRow, col, &records[at], textLen);
+        applied = at + textLen;
+        (*amt)++;
+    }
+    return applied;
+}
+
+// Asks a yes or no question in the status bar.
+bool editorAsk(const char *question) {
+    editor.prompting = true;
+    while (true) {
+        editorSetStatusMessage("%s (y/n)", question);
+        editorRefreshScreen();
+
+        int ch = editorReadKey();
+        if (ch == 'y' || ch == 'Y' || ch == 'n' || ch == 'N' || ch == '\x1b') {
+            editor.prompting = false;
+            return ch == 'y' || ch == 'Y';
+        }
+    }
+}
+
+// Looks for the journal of the opened file, left behind if the editor died 
+// with unsaved edits, and offers to replay them. The whole file is loaded 
+// first if there is one.
+void journalRecover(struct Journal *journal) {
+    free(journal->path);
+    journal->path = journalPathFor(editor.filename);
+
+    int fd = open(journal->path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    editorFinishLoading();
+
+    struct stat st;
+    struct JournalHeader header, expected;
+    journalMakeHeader(&expected, editor.filename);
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(header) 
+        || read(fd, &header, sizeof(header)) != sizeof(header) 
+        || memcmp(&header, &expected, sizeof(header)) != 0) {
+        close(fd);
+        editorSetStatusMessage("Ignoring a journal that does not match the file");
+        return;
+    }
+    size_t len = st.st_size - sizeof(header);
+    if (len == 0 || !editorAsk("Found unsaved changes from a previous session. Recover them?")) {
+        close(fd);
+        unlink(journal->path);
+        editorSetStatusMessage("");
+        return;
+    }
+
+    char *records = malloc(len);
+    if (read(fd, records, len) != (ssize_t)len) {
+        len = 0;
+    }
+    close(fd);
+
+    // The replayed edits are already journaled, and are undone as one step.
+    journal->paused = true;
+    undoCloseGroup(&editor.undo);
+    int amt;
+    size_t applied = journalReplay(records, len, &amt);
+    undoCloseGroup(&editor.undo);
+    journal->paused = false;
+
+    // Keep only the edits that could be replayed.
+    journalRewrite(journal, records, applied);
+    free(records);
+
+    editorSetStatusMessage("Recovered %d edits%s", amt, (applied == len)? "" : ", the rest of the journal is damaged");
+}
+
+// Records an edit of the buffer in the journal and the undo log.
+void editorRecordEdit(enum EditOp op, int fileRow, int col, const char *text, int len) {
+    journalRecord(&editor.journal, op, fileRow, col, text, len);
+    undoRecord(op, fileRow, col, text, len);
+}
+
+/*
+ * File IO.
+ */
+
+// Returns the offset of the first line feed in `buf` at or after `from`, or 
+// `len` if there is none. Scans a whole vector register's worth of bytes at a 
+// time where SIMD instructions are available.
+size_t findNewline(const char *buf, size_t from, size_t len) {
+    size_t i = from;
+
+#if defined(__AVX2__)
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newlines));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i newlines = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)&buf[i]);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newlines));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < len; ++i) {
+        if (buf[i] == '\n') {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Starts loading the file by memory mapping it. The rows of the file point 
+// into the mapping instead of each getting a copy of their line. Returns 
+// false if the file could not be mapped.
+bool editorOpenMapped(int fd, size_t fileSize) {
+    char *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    editor.fileMap = map;
+    editor.fileMapSize = fileSize;
+
+    editor.load.size = fileSize;
+    return true;
+}
+
+// Reads the next chunk of a file that is not memory mapped after the line 
+// that was cut off at the end of the last slab, and loads the lines that are 
+// complete then as rows pointing into it. The buffer then becomes a slab, 
+// kept for as long as the editor runs like the memory mapped file, and the 
+// line cut off at its end is moved to a new one. A line longer than a chunk 
+// grows in its buffer over several calls, and only the newly read bytes are 
+// searched for its end. Returns whether the end of the file was reached.
+bool editorLoadSlab(struct FileLoad *load) {
+    size_t readLen = TERMINAL_EDITOR_LOAD_CHUNK_SIZE;
+    if (load->size > load->offset && load->size - load->offset < readLen) {
+        // Ask for one byte more than what is left, to see the end of the file.
+        readLen = load->size - load->offset + 1;
+    }
+    if (load->pendingLen + readLen > load->pendingCapacity) {
+        load->pendingCapacity = load->pendingLen + readLen;
+        if (load->pendingCapacity < load->pendingLen * 2) {
+            load->pendingCapacity = load->pendingLen * 2;
+        }
+        load->pending = realloc(load->pending, load->pendingCapacity);
+        if (load->pending == NULL) {
+            die("realloc");
+        }
+    }
+    char *slab = load->pending;
+    size_t readAmt = fread(&slab[load->pendingLen], 1, readLen, load->fp);
+    size_t searched = load->pendingLen;
+    size_t len = load->pendingLen + readAmt;
+    bool done = (readAmt < readLen);
+    load->offset += readAmt;
+
+    // The last line is only loaded once it is complete.
+    size_t end = len;
+    if (!done) {
+        while (end > searched && slab[end - 1] != '\n') {
+            end--;
+        }
+        if (end == searched) {
+            load->pendingLen = len;
+            return false;
+        }
+    }
+
+    // Move the line cut off at the end to a new buffer, before the rows 
+    // point into this one.
+    load->pending = NULL;
+    load->pendingLen = len - end;
+    load->pendingCapacity = 0;
+    if (!done) {
+        load->pendingCapacity = load->pendingLen + TERMINAL_EDITOR_LOAD_CHUNK_SIZE;
+        load->pending = malloc(load->pendingCapacity);
+        if (load->pending == NULL) {
+            die("malloc");
+        }
+        memcpy(load->pending, &slab[end], load->pendingLen);
+    }
+    if (end == 0) {
+        free(slab);
+        return done;
+    }
+    slab = realloc(slab, end);
+    if (slab == NULL) {
+        die("realloc");
+    }
+
+    size_t lineStart = 0;
+    while (lineStart < end) {
+        size_t lineEnd = findNewline(slab, (lineStart > searched)? lineStart : searched, end);
+        size_t lineLen = lineEnd - lineStart;
+        while (lineLen > 0 && slab[lineStart + lineLen - 1] == '\r') {
+            lineLen--;
+        }
+        editorInsertRowChars(load->nextRow, &slab[lineStart], lineLen, true);
+
+        lineStart = lineEnd + 1;
+    }
+    return done;
+}
+
+// Loads the next chunk of the file being opened. Returns whether there is 
+// still more of the file left to load.
+bool editorLoadStep() {
+    if (!editor.load.active) {
+        return false;
+    }
+    struct FileLoad *load = &editor.load;
+    size_t chunkEnd = load->offset + TERMINAL_EDITOR_LOAD_CHUNK_SIZE;
+    bool done;
+
+    // The loaded rows are part of the file, so they must not mark it as dirty, 
+    // be undoable or be journaled.
+    unsigned long version = editor.version;
+    editor.undo.paused = true;
+    editor.journal.paused = true;
+
+    if (editor.fileMap) {
+        char *map = editor.fileMap;
+        size_t lineStart = load->offset;
+
+        while (lineStart < load->size && lineStart < chunkEnd) {
+            size_t lineEnd = findNewline(map, lineStart, load->size);
+
+            size_t lineLen = lineEnd - lineStart;
+            while (lineLen > 0 && map[lineStart + lineLen - 1] == '\r') {
+                lineLen--;
+            }
+            editorInsertRowChars(load->nextRow, &map[lineStart], lineLen, true);
+
+            lineStart = lineEnd + 1;
+        }
+        load->offset = (lineStart < load->size) ? lineStart : load->size;
+        done = (load->offset == load->size);
+    }
+    else {
+        done = editorLoadSlab(load);
+
+        if (done) {
+            free(load->pending);
+            fclose(load->fp);
+            load->pending = NULL;
+            load->pendingLen = 0;
+            load->pendingCapacity = 0;
+            load->fp = NULL;
+        }
+    }
+    editor.version = version;
+    editor.undo.paused = false;
+    editor.journal.paused = false;
+
+    load->active = !done;
+    return load->active;
+}
+
+// Blocks until the whole file is loaded.
+void editorFinishLoading() {
+    while (editorLoadStep()) {}
+}
+
+void editorOpen(char *filename) {
+    free(editor.filename);
+    editor.filename = strdup(filename);
+
+    editorSelectSyntaxHighlight();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        die("open");
+    }
+
+    editor.load.active = true;
+    editor.load.offset = 0;
+    editor.load.size = 0;
+    editor.load.nextRow = editor.rowAmt;
+
+    struct stat st;
+    bool isRegular = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+
+    if (isRegular && st.st_size >= TERMINAL_EDITOR_MMAP_MIN_SIZE && editorOpenMapped(fd, st.st_size)) {
+        close(fd);
+    }
+    else {
+        editor.load.fp = fdopen(fd, "r");
+        if (!editor.load.fp) {
+            die("fdopen");
+        }
+        editor.load.size = isRegular ? st.st_size : 0;
+    }
+
+    // Load the first chunk right away so that the first screen can be drawn, 
+    // the rest is loaded in between keypresses.
+    editorLoadStep();
+
+    journalRecover(&editor.journal);
+}
+
+void saveAddIovec(struct SaveJob *save, void *base, size_t len) {
+    if (save->iovAmt == save->iovCapacity) {
+        save->iovCapacity = (save->iovCapacity > 0)? save->iovCapacity * 2 : 1024;
+        save->iov = realloc(save->iov, save->iovCapacity * sizeof(struct iovec));
+        if (save->iov == NULL) {
+            die("realloc");
+        }
+    }
+    save->iov[save->iovAmt].iov_base = base;
+    save->iov[save->iovAmt].iov_len = len;
+    save->iovAmt++;
+}
+
+// Takes a snapshot of the rows for the save to write: a list of the buffers 
+// making up the file, pointing straight into the rows' `chars` arrays. 
+// Unedited rows that follow each other in the file's loaded contents are 
+// snapshotted along with the line feeds in between them as a single buffer, 
+// so the snapshot of a mostly unedited file is small.
+void saveSnapshotRows(struct SaveJob *save) {
+    static const char newline = '\n';
+    bool lastMapped = false;
+
+    save->iovAmt = 0;
+    struct RowIter it = editorRowIterAt(0);
+    struct TextRow *row;
+    while ((row = editorRowIterNext(&it)) != NULL) {
+        if (row->charsMapped && lastMapped) {
+            struct iovec *last = &save->iov[save->iovAmt - 2];
+            if ((char *)last->iov_base + last->iov_len == row->chars - 1 && row->chars[-1] == '\n') {
+                last->iov_len += 1 + row->size;
+                continue;
+            }
+        }
+        // A long row is written out from around its gap.
+        struct LongRow *longRow = row->longRow;
+        if (longRow != NULL && longRow->gapLen > 0 && longRow->gapStart < row->size) {
+            saveAddIovec(save, row->chars, longRow->gapStart);
+            saveAddIovec(save, &row->chars[longRow->gapStart + longRow->gapLen], row->size - longRow->gapStart);
+        }
+        else {
+            saveAddIovec(save, row->chars, row->size);
+        }
+        saveAddIovec(save, (void *)&newline, 1);
+        lastMapped = row->charsMapped;
+    }
+}
+
+// Writes the buffers to `fd` with `writev`, TERMINAL_EDITOR_SAVE_IOV_MAX at a 
+// time. Returns the amount of bytes written, or -1 on error.
+ssize_t saveWriteIovecs(int fd, struct iovec *iov, int iovAmt) {
+    ssize_t total = 0;
+
+    while (iovAmt > 0) {
+        int batch = (iovAmt < TERMINAL_EDITOR_SAVE_IOV_MAX)? iovAmt : TERMINAL_EDITOR_SAVE_IOV_MAX;
+        ssize_t written = writev(fd, iov, batch);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += written;
+
+        // Resume after partial writes from the first buffer that was not 
+        // written out in full.
+        while (iovAmt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovAmt--;
+        }
+        if (iovAmt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return total;
+}
+
+// Opens a new temporary file in the same directory as `path`, so it can be 
+// renamed over it. Its name is stored into `tmpPath`, which must be freed.
+int saveOpenTempFileFor(const char *path, char **tmpPath) {
+    const char *slash = strrchr(path, '/');
+    int dirLen = (slash != NULL)? slash - path + 1 : 0;
+
+    size_t size = strlen(path) + 16;
+    *tmpPath = malloc(size);
+    snprintf(*tmpPath, size, "%.*s.%s.XXXXXX", dirLen, path, &path[dirLen]);
+    return mkstemp(*tmpPath);
+}
+
+// Writes the snapshot to a temporary file that then replaces the file, so a 
+// crash in the middle of saving leaves the old file intact. Rows still 
+// pointing into the memory mapped file stay valid, since the mapping keeps 
+// the replaced file's contents around.
+void *saveThreadMain(void *arg) {
+    struct SaveJob *save = arg;
+    ssize_t written = -1;
+
+    char *tmpPath;
+    int fd = saveOpenTempFileFor(save->path, &tmpPath);
+    if (fd != -1) {
+        written = saveWriteIovecs(fd, save->iov, save->iovAmt);
+        if (written == -1 || fchmod(fd, save->mode) == -1 || fsync(fd) == -1) {
+            written = -1;
+        }
+        if (close(fd) == -1) {
+            written = -1;
+        }
+        if (written != -1 && rename(tmpPath, save->path) == -1) {
+            written = -1;
+        }
+        if (written == -1) {
+            int savedErrno = errno;
+            unlink(tmpPath);
+            errno = savedErrno;
+        }
+    }
+    free(tmpPath);
+    save->error = errno;
+
+    // Make the rename itself durable.
+    if (written != -1) {
+        char *slash = strrchr(save->path, '/');
+        char *dir = ".";
+        if (slash == save->path) {
+            dir = "/";
+        }
+        else if (slash != NULL) {
+            *slash = '\0';
+            dir = save->path;
+        }
+        int dirFd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (dirFd != -1) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+    }
+
+    save->written = written;
+    char done = 1;
+    write(save->wakeFds[1], &done, 1);
+    return NULL;
+}
+
+// Waits for the background save, if there is one, and reports how it went.
+void editorFinishSave() {
+    struct SaveJob *save = &editor.save;
+    if (!save->active) {
+        return;
+    }
+    pthread_join(save->thread, NULL);
+
+    char done;
+    read(save->wakeFds[0], &done, 1);
+
+    save->active = false;
+    for (int i = 0; i < save->garbageAmt; ++i) {
+        free(save->garbage[i]);
+    }
+    save->garbageAmt = 0;
+    free(save->path);
+    save->path = NULL;
+
+    if (save->written == -1) {
+        editorSetStatusMessage("Cannot save file: %s", strerror(save->error));
+        return;
+    }
+    editor.savedVersion = save->version;
+    journalSaveDone(&editor.journal);
+    editorSetStatusMessage("%zd bytes written to disk", save->written);
+}
+
+// Whether the buffer has changes that were not saved.
+bool editorIsDirty() {
+    return editor.version != editor.savedVersion;
+}
+
+// Starts saving the buffer in a background thread. Editing goes on while the 
+// file is written, the result is reported once it is done.
+void editorSave() {
+    if (editor.save.active) {
+        editorSetStatusMessage("Already saving, please wait");
+        return;
+    }
+    if (editor.filename == NULL) {
+        editor.filename = editorPrompt("Save as: %s", NULL);
+
+        if (editor.filename == NULL) {
+            editorSetStatusMessage("Save aborted.");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    // Only the part of the file that was already loaded would be written.
+    editorFinishLoading();
+
+    struct SaveJob *save = &editor.save;
+
+    // Replace the file a symbolic link points to rather than the link.
+    save->path = realpath(editor.filename, NULL);
+    if (save->path == NULL) {
+        save->path = strdup(editor.filename);
+    }
+
+    // Keep the permissions of the file, or give a new file the usual ones.
+    struct stat st;
+    if (stat(save->path, &st) == 0) {
+        save->mode = st.st_mode & 07777;
+    }
+    else {
+        mode_t mask = umask(0);
+        umask(mask);
+        save->mode = 0644 & ~mask;
+    }
+
+    if (save->wakeFds[0] == -1 && pipe(save->wakeFds) == -1) {
+        die("pipe");
+    }
+
+    // From now on, the rows' current `chars` buffers belong to the snapshot.
+    saveSnapshotRows(save);
+    journalSaveStarted(&editor.journal);
+    save->version = editor.version;
+    save->epoch = ++editor.charsEpoch;
+    save->active = true;
+
+    if (pthread_create(&save->thread, NULL, saveThreadMain, save) != 0) {
+        die("pthread_create");
+    }
+    editorSetStatusMessage("Saving...");
+}
+
+/*
+ * Regular expressions.
+ *
+ * Patterns are parsed into a syntax tree, which is compiled into a Thompson 
+ * NFA twice: once to match forwards and once to match backwards. Matching 
+ * runs DFAs whose states are sets of NFA states. They are built lazily, as 
+ * the text needs them, and cached, so matching never backtracks and takes 
+ * time linear in the text. The cache is flushed when it is full, which 
+ * bounds the memory a pattern can take.
+ *
+ * Supported syntax: literal characters, `.`, classes like `[a-z_]` and 
+ * `[^0-9]`, the escapes `\d \w \s \D \W \S` and escaped metacharacters, 
+ * `^`, `$`, groups, `|`, `*`, `+` and `?`.
+ */
+
+enum RegexNodeType {
+    RE_CLASS,
+    RE_EMPTY,
+    RE_CONCAT,
+    RE_ALTERNATE,
+    RE_STAR,
+    RE_PLUS,
+    RE_QUEST,
+    RE_LINE_START,
+    RE_LINE_END,
+};
+
+struct RegexNode {
+    enum RegexNodeType type;
+    int left;
+    int right;
+    int classIndex;
+};
+
+enum NfaStateType {
+    NFA_CLASS,
+    NFA_SPLIT,
+    NFA_MATCH,
+    // Assertions that can only be passed at the start or end of the text.
+    NFA_TEXT_START,
+    NFA_TEXT_END,
+};
+
+struct NfaState {
+    enum NfaStateType type;
+    int out;
+    int out1;
+    int classIndex;
+};
+
+struct Nfa {
+    struct NfaState *states;
+    int stateAmt;
+    int start;
+};
+
+#define DFA_UNKNOWN -1
+
+struct DfaState {
+    // The NFA states the DFA state stands for, sorted.
+    int *nfaStates;
+    int nfaStateAmt;
+
+    // Whether a match ends here, and whether one ends here when this is 
+    // also the end of the text.
+    bool accepting;
+    bool acceptingAtEnd;
+
+    // The state reached on each byte, or `DFA_UNKNOWN` if not built yet.
+    int next[256];
+};
+
+struct Dfa {
+    struct Nfa *nfa;
+    struct RegexClass *classes;
+
+    // Unanchored DFAs look for matches starting anywhere, not just at the 
+    // start of the text.
+    bool unanchored;
+
+    struct DfaState *states;
+    int stateAmt;
+    unsigned int flushAmt;
+
+    // Open addressing hash table of state indices, keyed by NFA state sets.
+    int *table;
+    int tableSize;
+
+    // The start states for the start of the text and for anywhere else.
+    int startStates[2];
+
+    // Scratch space for building NFA state sets. The set has room for the 
+    // states passed at the end of the text on top of a full set.
+    int *set;
+    int *stack;
+    unsigned int *marks;
+    unsigned int markGeneration;
+};
+
+struct RegexClass {
+    unsigned char bits[32];
+};
+
+// A run of the forward DFA through the text, for the matches that begin at 
+// one or more positions. Runs that reach the same state at the same 
+// position go on the same way from there, so one of them ends and refers to 
+// the other.
+struct RegexRun {
+    // The run this one was merged into and the position where it was, or 
+    // -1 while the run goes on by itself.
+    int merged;
+    int mergedAt;
+
+    // The last position where the run was in an accepting state, or -1.
+    int lastAccept;
+};
+
+struct Regex {
+    struct RegexClass *classes;
+    int classAmt;
+    struct Nfa forward;
+    struct Nfa reverse;
+
+    // Finds whether there is a match, finds where matches begin, and finds 
+    // where a match that begins at a given position ends.
+    struct Dfa searchDfa;
+    struct Dfa reverseDfa;
+    struct Dfa forwardDfa;
+
+    // The bytes a match can begin with. When only one can, it is 
+    // `firstByte`, otherwise that is -1.
+    struct RegexClass firstBytes;
+    int firstByte;
+
+    // Scratch space for following the forward DFA from many positions at 
+    // once. The runs still going on are listed with their states, and 
+    // `stateSlots` finds the one in a given state when its mark is current.
+    struct RegexRun *runs;
+    int runCapacity;
+    int *path;
+    int *activeRuns;
+    int *activeStates;
+    int *stateSlots;
+    unsigned int *stateMarks;
+    unsigned int markGeneration;
+};
+
+struct RegexParser {
+    const char *p;
+    bool ignoreCase;
+    const char *error;
+
+    struct RegexNode *nodes;
+    int nodeAmt;
+    int nodeCapacity;
+
+    struct RegexClass *classes;
+    int classAmt;
+    int classCapacity;
+};
+
+int regexNewNode(struct RegexParser *parser, enum RegexNodeType type, int left, int right) {
+    if (parser->nodeAmt == parser->nodeCapacity) {
+        parser->nodeCapacity = (parser->nodeCapacity > 0)? parser->nodeCapacity * 2 : 32;
+        parser->nodes = realloc(parser->nodes, parser->nodeCapacity * sizeof(struct RegexNode));
+        if (parser->nodes == NULL) {
+            die("realloc");
+        }
+    }
+    struct RegexNode *node = &parser->nodes[parser->nodeAmt];
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->classIndex = -1;
+    return parser->nodeAmt++;
+}
+
+int regexNewClass(struct RegexParser *parser) {
+    if (parser->classAmt == parser->classCapacity) {
+        parser->classCapacity = (parser->classCapacity > 0)? parser->classCapacity * 2 : 16;
+        parser->classes = realloc(parser->classes, parser->classCapacity * sizeof(struct RegexClass));
+        if (parser->classes == NULL) {
+            die("realloc");
+        }
+    }
+    memset(&parser->classes[parser->classAmt], 0, sizeof(struct RegexClass));
+    return parser->classAmt++;
+}
+
+void regexClassAdd(struct RegexParser *parser, int classIndex, int c) {
+    unsigned char *bits = parser->classes[classIndex].bits;
+    bits[c >> 3] |= 1 << (c & 7);
+    if (parser->ignoreCase && isalpha(c)) {
+        int other = islower(c)? toupper(c) : tolower(c);
+        bits[other >> 3] |= 1 << (other & 7);
+    }
+}
+
+bool regexClassHas(const struct RegexClass *regexClass, int c) {
+    return regexClass->bits[c >> 3] & (1 << (c & 7));
+}
+
+// Adds the characters of the escape `\c` that stands for a set of 
+// characters. Returns false if it is not one.
+bool regexClassAddEscape(struct RegexParser *parser, int classIndex, int c) {
+    int lower = tolower(c);
+    if (lower != 'd' && lower != 'w' && lower != 's') {
+        return false;
+    }
+    for (int i = 0; i < 256; ++i) {
+        bool inSet = (lower == 'd')? isdigit(i) : (lower == 'w')? isWordChar(i) : isspace(i);
+        if (inSet != (bool)isupper(c)) {
+            regexClassAdd(parser, classIndex, i);
+        }
+    }
+    return true;
+}
+
+int regexParseAlternate(struct RegexParser *parser);
+
+// Parses a bracketed class, after the opening `[`.
+int regexParseClass(struct RegexParser *parser) {
+    int classIndex = regexNewClass(parser);
+    bool negate = false;
+    if (*parser->p == '^') {
+        negate = true;
+        parser->p++;
+    }
+
+    bool first = true;
+    while (*parser->p != ']' || first) {
+        if (*parser->p == '\0') {
+            parser->error = "missing ]";
+            return -1;
+        }
+        first = false;
+
+        int c = (unsigned char)*parser->p++;
+        if (c == '\\' && *parser->p != '\0') {
+            c = (unsigned char)*parser->p++;
+            if (regexClassAddEscape(parser, classIndex, c)) {
+                continue;
+            }
+        }
+
+        int last = c;
+        if (parser->p[0] == '-' && parser->p[1] != ']' && parser->p[1] != '\0') {
+            last = (unsigned char)parser->p[1];
+            parser->p += 2;
+            if (last < c) {
+                parser->error = "bad range";
+                return -1;
+            }
+        }
+        for (int i = c; i <= last; ++i) {
+            regexClassAdd(parser, classIndex, i);
+        }
+    }
+    parser->p++;
+
+    if (negate) {
+        for (int i = 0; i < 32; ++i) {
+            parser->classes[classIndex].bits[i] ^= 0xff;
+        }
+    }
+    int node = regexNewNode(parser, RE_CLASS, -1, -1);
+    parser->nodes[node].classIndex = classIndex;
+    return node;
+}
+
+int regexParseAtom(struct RegexParser *parser) {
+    int c = (unsigned char)*parser->p++;
+
+    if (c == '(') {
+        int node = regexParseAlternate(parser);
+        if (node == -1) {
+            return -1;
+        }
+        if (*parser->p != ')') {
+            parser->error = "missing )";
+            return -1;
+        }
+        parser->p++;
+        return node;
+    }
+    else if (c == '[') {
+        return regexParseClass(parser);
+    }
+    else if (c == '^') {
+        return regexNewNode(parser, RE_LINE_START, -1, -1);
+    }
+    else if (c == '$') {
+        return regexNewNode(parser, RE_LINE_END, -1, -1);
+    }
+    else if (c == '*' || c == '+' || c == '?') {
+        parser->error = "nothing to repeat";
+        return -1;
+    }
+
+    int classIndex = regexNewClass(parser);
+    if (c == '.') {
+        memset(parser->classes[classIndex].bits, 0xff, 32);
+    }
+    else if (c == '\\') {
+        if (*parser->p == '\0') {
+            parser->error = "trailing \\";
+            return -1;
+        }
+        c = (unsigned char)*parser->p++;
+        if (!regexClassAddEscape(parser, classIndex, c)) {
+            regexClassAdd(parser, classIndex, c);
+        }
+    }
+    else {
+        regexClassAdd(parser, classIndex, c);
+    }
+    int node = regexNewNode(parser, RE_CLASS, -1, -1);
+    parser->nodes[node].classIndex = classIndex;
+    return node;
+}
+
+int regexParseRepeat(struct RegexParser *parser) {
+    int node = regexParseAtom(parser);
+    while (node != -1) {
+        enum RegexNodeType type;
+        if (*parser->p == '*') {
+            type = RE_STAR;
+        }
+        else if (*parser->p == '+') {
+            type = RE_PLUS;
+        }
+        else if (*parser->p == '?') {
+            type = RE_QUEST;
+        }
+        else {
+            break;
+        }
+        parser->p++;
+        node = regexNewNode(parser, type, node, -1);
+    }
+    return node;
+}
+
+int regexParseConcat(struct RegexParser *parser) {
+    int node = regexNewNode(parser, RE_EMPTY, -1, -1);
+    while (*parser->p != '\0' && *parser->p != '|' && *parser->p != ')') {
+        int next = regexParseRepeat(parser);
+        if (next == -1) {
+            return -1;
+        }
+        node = regexNewNode(parser, RE_CONCAT, node, next);
+    }
+    return node;
+}
+
+int regexParseAlternate(struct RegexParser *parser) {
+    int node = regexParseConcat(parser);
+    while (node != -1 && *parser->p == '|') {
+        parser->p++;
+        int next = regexParseConcat(parser);
+        if (next == -1) {
+            return -1;
+        }
+        node = regexNewNode(parser, RE_ALTERNATE, node, next);
+    }
+    return node;
+}
+
+int nfaNewState(struct Nfa *nfa, enum NfaStateType type, int out, int out1) {
+    // Every node needs at most one state, so the states never outgrow the 
+    // space reserved for them.
+    struct NfaState *state = &nfa->states[nfa->stateAmt];
+    state->type = type;
+    state->out = out;
+    state->out1 = out1;
+    state->classIndex = -1;
+    return nfa->stateAmt++;
+}
+
+// Compiles the node into NFA states that continue to `next` when they 
+// match, and returns the state to start at. When `reverse` is set, the 
+// states match the node's text backwards.
+int nfaCompileNode(struct Nfa *nfa, struct RegexNode *nodes, int nodeIndex, int next, bool reverse) {
+    struct RegexNode *node = &nodes[nodeIndex];
+    int state;
+
+    switch (node->type) {
+        case RE_CLASS:
+            state = nfaNewState(nfa, NFA_CLASS, next, -1);
+            nfa->states[state].classIndex = node->classIndex;
+            return state;
+
+        case RE_EMPTY:
+            return next;
+
+        case RE_CONCAT:
+            if (reverse) {
+                return nfaCompileNode(nfa, nodes, node->right, 
+                    nfaCompileNode(nfa, nodes, node->left, next, reverse), reverse);
+            }
+            return nfaCompileNode(nfa, nodes, node->left, 
+                nfaCompileNode(nfa, nodes, node->right, next, reverse), reverse);
+
+        case RE_ALTERNATE: {
+            int left = nfaCompileNode(nfa, nodes, node->left, next, reverse);
+            int right = nfaCompileNode(nfa, nodes, node->right, next, reverse);
+            return nfaNewState(nfa, NFA_SPLIT, left, right);
+        }
+
+        case RE_STAR:
+        case RE_PLUS:
+            state = nfaNewState(nfa, NFA_SPLIT, -1, next);
+            nfa->states[state].out = nfaCompileNode(nfa, nodes, node->left, state, reverse);
+            return (node->type == RE_STAR)? state : nfa->states[state].out;
+
+        case RE_QUEST:
+            return nfaNewState(nfa, NFA_SPLIT, nfaCompileNode(nfa, nodes, node->left, next, reverse), next);
+
+        case RE_LINE_START:
+            return nfaNewState(nfa, reverse? NFA_TEXT_END : NFA_TEXT_START, next, -1);
+
+        case RE_LINE_END:
+            return nfaNewState(nfa, reverse? NFA_TEXT_START : NFA_TEXT_END, next, -1);
+    }
+    return next;
+}
+
+void nfaCompile(struct Nfa *nfa, struct RegexNode *nodes, int nodeAmt, int root, bool reverse) {
+    nfa->states = malloc((nodeAmt + 1) * sizeof(struct NfaState));
+    if (nfa->states == NULL) {
+        die("malloc");
+    }
+    nfa->stateAmt = 0;
+    int match = nfaNewState(nfa, NFA_MATCH, -1, -1);
+    nfa->start = nfaCompileNode(nfa, nodes, root, match, reverse);
+}
+
+void dfaInit(struct Dfa *dfa, struct Nfa *nfa, struct RegexClass *classes, bool unanchored) {
+    dfa->nfa = nfa;
+    dfa->classes = classes;
+    dfa->unanchored = unanchored;
+
+    dfa->states = NULL;
+    dfa->stateAmt = 0;
+    dfa->flushAmt = 0;
+
+    // The table stays at most half full.
+    dfa->tableSize = TERMINAL_EDITOR_DFA_MAX_STATES * 2;
+    dfa->table = malloc(dfa->tableSize * sizeof(int));
+
+    dfa->set = malloc(2 * nfa->stateAmt * sizeof(int));
+    dfa->stack = malloc(nfa->stateAmt * sizeof(int));
+    dfa->marks = calloc(nfa->stateAmt, sizeof(unsigned int));
+    dfa->markGeneration = 0;
+    if (dfa->table == NULL || dfa->set == NULL || dfa->stack == NULL || dfa->marks == NULL) {
+        die("malloc");
+    }
+
+    for (int i = 0; i < dfa->tableSize; ++i) {
+        dfa->table[i] = -1;
+    }
+    dfa->startStates[0] = DFA_UNKNOWN;
+    dfa->startStates[1] = DFA_UNKNOWN;
+}
+
+// Drops every built state. The DFA starts over from an empty cache.
+void dfaFlush(struct Dfa *dfa) {
+    for (int i = 0; i < dfa->stateAmt; ++i) {
+        free(dfa->states[i].nfaStates);
+    }
+    dfa->stateAmt = 0;
+    dfa->flushAmt++;
+    for (int i = 0; i < dfa->tableSize; ++i) {
+        dfa->table[i] = -1;
+    }
+    dfa->startStates[0] = DFA_UNKNOWN;
+    dfa->startStates[1] = DFA_UNKNOWN;
+}
+
+void dfaFree(struct Dfa *dfa) {
+    dfaFlush(dfa);
+    free(dfa->states);
+    free(dfa->table);
+    free(dfa->set);
+    free(dfa->stack);
+    free(dfa->marks);
+}
+
+// Adds the NFA states reachable from `state` without consuming a character 
+// to the set of `*setAmt` states. Text start and end assertions are only 
+// passed when `atStart` and `atEnd` are set, text end assertions are kept 
+// in the set otherwise so they can be passed later.
+void dfaAddClosure(struct Dfa *dfa, int state, int *setAmt, bool atStart, bool atEnd) {
+    int stackAmt = 0;
+    if (dfa->marks[state] != dfa->markGeneration) {
+        dfa->marks[state] = dfa->markGeneration;
+        dfa->stack[stackAmt++] = state;
+    }
+
+    while (stackAmt > 0) {
+        struct NfaState *nfaState = &dfa->nfa->states[dfa->stack[--stackAmt]];
+        int follow[2] = {-1, -1};
+
+        switch (nfaState->type) {
+            case NFA_CLASS:
+            case NFA_MATCH:
+                dfa->set[(*setAmt)++] = nfaState - dfa->nfa->states;
+                break;
+            case NFA_SPLIT:
+                follow[0] = nfaState->out;
+                follow[1] = nfaState->out1;
+                break;
+            case NFA_TEXT_START:
+                if (atStart) {
+                    follow[0] = nfaState->out;
+                }
+                break;
+            case NFA_TEXT_END:
+                if (atEnd) {
+                    follow[0] = nfaState->out;
+                }
+                else {
+                    dfa->set[(*setAmt)++] = nfaState - dfa->nfa->states;
+                }
+                break;
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            if (follow[i] != -1 && dfa->marks[follow[i]] != dfa->markGeneration) {
+                dfa->marks[follow[i]] = dfa->markGeneration;
+                dfa->stack[stackAmt++] = follow[i];
+            }
+        }
+    }
+}
+
+void dfaNewMarks(struct Dfa *dfa) {
+    dfa->markGeneration++;
+    if (dfa->markGeneration == 0) {
+        memset(dfa->marks, 0, dfa->nfa->stateAmt * sizeof(unsigned int));
+        dfa->markGeneration = 1;
+    }
+}
+
+int compareInts(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+unsigned int dfaHashSet(const int *set, int setAmt) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < setAmt; ++i) {
+        hash = (hash ^ (unsigned int)set[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the state for the `setAmt` NFA states in `dfa->set`, building it 
+// if it does not exist yet.
+int dfaStateForSet(struct Dfa *dfa, int setAmt) {
+    qsort(dfa->set, setAmt, sizeof(int), compareInts);
+
+    unsigned int slot = dfaHashSet(dfa->set, setAmt) & (dfa->tableSize - 1);
+    while (dfa->table[slot] != -1) {
+        struct DfaState *state = &dfa->states[dfa->table[slot]];
+        if (state->nfaStateAmt == setAmt && memcmp(state->nfaStates, dfa->set, setAmt * sizeof(int)) == 0) {
+            return dfa->table[slot];
+        }
+        slot = (slot + 1) & (dfa->tableSize - 1);
+    }
+
+    // Start over once the cache is full. The set being looked up is in 
+    // scratch space, so it survives the flush.
+    if (dfa->stateAmt == TERMINAL_EDITOR_DFA_MAX_STATES) {
+        dfaFlush(dfa);
+        slot = dfaHashSet(dfa->set, setAmt) & (dfa->tableSize - 1);
+    }
+    if (dfa->states == NULL) {
+        dfa->states = malloc(TERMINAL_EDITOR_DFA_MAX_STATES * sizeof(struct DfaState));
+        if (dfa->states == NULL) {
+            die("malloc");
+        }
+    }
+
+    int index = dfa->stateAmt++;
+    struct DfaState *state = &dfa->states[index];
+    state->nfaStates = malloc((setAmt > 0)? setAmt * sizeof(int) : 1);
+    if (state->nfaStates == NULL) {
+        die("malloc");
+    }
+    memcpy(state->nfaStates, dfa->set, setAmt * sizeof(int));
+    state->nfaStateAmt = setAmt;
+    for (int c = 0; c < 256; ++c) {
+        state->next[c] = DFA_UNKNOWN;
+    }
+
+    // Work out whether a match ends here, passing the text end assertions 
+    // for the end of the text.
+    state->accepting = false;
+    state->acceptingAtEnd = false;
+    dfaNewMarks(dfa);
+    int endAmt = setAmt;
+    for (int i = 0; i < setAmt; ++i) {
+        if (dfa->nfa->states[state->nfaStates[i]].type == NFA_MATCH) {
+            state->accepting = true;
+        }
+        if (dfa->nfa->states[state->nfaStates[i]].type == NFA_TEXT_END) {
+            dfaAddClosure(dfa, state->nfaStates[i], &endAmt, false, true);
+        }
+    }
+    state->acceptingAtEnd = state->accepting;
+    for (int i = setAmt; i < endAmt; ++i) {
+        if (dfa->nfa->states[dfa->set[i]].type == NFA_MATCH) {
+            state->acceptingAtEnd = true;
+        }
+    }
+
+    dfa->table[slot] = index;
+    return index;
+}
+
+// Returns the state to start matching at, at the start of the text or 
+// anywhere else.
+int dfaStart(struct Dfa *dfa, bool atStart) {
+    if (dfa->startStates[atStart] == DFA_UNKNOWN) {
+        dfaNewMarks(dfa);
+        int setAmt = 0;
+        dfaAddClosure(dfa, dfa->nfa->start, &setAmt, atStart, false);
+        int state = dfaStateForSet(dfa, setAmt);
+        dfa->startStates[atStart] = state;
+    }
+    return dfa->startStates[atStart];
+}
+
+// Returns the state reached from `stateIndex` on the character `c`, which 
+// is never at the start of the text.
+int dfaStep(struct Dfa *dfa, int stateIndex, unsigned char c) {
+    struct DfaState *state = &dfa->states[stateIndex];
+    if (state->next[c] != DFA_UNKNOWN) {
+        return state->next[c];
+    }
+
+    dfaNewMarks(dfa);
+    int setAmt = 0;
+    for (int i = 0; i < state->nfaStateAmt; ++i) {
+        struct NfaState *nfaState = &dfa->nfa->states[state->nfaStates[i]];
+        if (nfaState->type == NFA_CLASS && regexClassHas(&dfa->classes[nfaState->classIndex], c)) {
+            dfaAddClosure(dfa, nfaState->out, &setAmt, false, false);
+        }
+    }
+    if (dfa->unanchored) {
+        dfaAddClosure(dfa, dfa->nfa->start, &setAmt, false, false);
+    }
+
+    // If building the next state flushed the cache, the state this step 
+    // started from is gone and there is nothing to remember the step in.
+    unsigned int flushAmt = dfa->flushAmt;
+    int next = dfaStateForSet(dfa, setAmt);
+    if (dfa->flushAmt == flushAmt) {
+        dfa->states[stateIndex].next[c] = next;
+    }
+    return next;
+}
+
+bool dfaIsDead(struct Dfa *dfa, int stateIndex) {
+    return dfa->states[stateIndex].nfaStateAmt == 0;
+}
+
+void regexFree(struct Regex *regex) {
+    if (regex == NULL) {
+        return;
+    }
+    dfaFree(&regex->searchDfa);
+    dfaFree(&regex->reverseDfa);
+    dfaFree(&regex->forwardDfa);
+    free(regex->runs);
+    free(regex->path);
+    free(regex->activeRuns);
+    free(regex->activeStates);
+    free(regex->stateSlots);
+    free(regex->stateMarks);
+    free(regex->forward.states);
+    free(regex->reverse.states);
+    free(regex->classes);
+    free(regex);
+}
+
+// Compiles `pattern`. Returns NULL and points `error` to a description of 
+// the problem if the pattern is malformed.
+struct Regex *regexCompile(const char *pattern, bool ignoreCase, const char **error) {
+    struct RegexParser parser = {0};
+    parser.p = pattern;
+    parser.ignoreCase = ignoreCase;
+
+    int root = regexParseAlternate(&parser);
+    if (root != -1 && *parser.p != '\0') {
+        parser.error = "unmatched )";
+        root = -1;
+    }
+    if (root == -1) {
+        *error = parser.error;
+        free(parser.nodes);
+        free(parser.classes);
+        return NULL;
+    }
+
+    struct Regex *regex = malloc(sizeof(struct Regex));
+    if (regex == NULL) {
+        die("malloc");
+    }
+    regex->classes = parser.classes;
+    regex->classAmt = parser.classAmt;
+    nfaCompile(&regex->forward, parser.nodes, parser.nodeAmt, root, false);
+    nfaCompile(&regex->reverse, parser.nodes, parser.nodeAmt, root, true);
+    free(parser.nodes);
+
+    dfaInit(&regex->searchDfa, &regex->forward, regex->classes, true);
+    dfaInit(&regex->reverseDfa, &regex->reverse, regex->classes, true);
+    dfaInit(&regex->forwardDfa, &regex->forward, regex->classes, false);
+
+    regex->runs = NULL;
+    regex->runCapacity = 0;
+    regex->path = NULL;
+    regex->activeRuns = malloc(TERMINAL_EDITOR_DFA_MAX_STATES * sizeof(int));
+    regex->activeStates = malloc(TERMINAL_EDITOR_DFA_MAX_STATES * sizeof(int));
+    regex->stateSlots = malloc(TERMINAL_EDITOR_DFA_MAX_STATES * sizeof(int));
+    regex->stateMarks = calloc(TERMINAL_EDITOR_DFA_MAX_STATES, sizeof(unsigned int));
+    regex->markGeneration = 0;
+    if (regex->activeRuns == NULL || regex->activeStates == NULL || regex->stateSlots == NULL 
+        || regex->stateMarks == NULL) {
+        die("malloc");
+    }
+
+    // The first bytes are the ones the start state can step on.
+    struct Dfa *dfa = &regex->searchDfa;
+    int startIndex = dfaStart(dfa, false);
+    struct DfaState *start = &dfa->states[startIndex];
+    memset(&regex->firstBytes, 0, sizeof(struct RegexClass));
+    for (int i = 0; i < start->nfaStateAmt; ++i) {
+        struct NfaState *nfaState = &regex->forward.states[start->nfaStates[i]];
+        if (nfaState->type == NFA_CLASS) {
+            for (int j = 0; j < 32; ++j) {
+                regex->firstBytes.bits[j] |= regex->classes[nfaState->classIndex].bits[j];
+            }
+        }
+    }
+    regex->firstByte = -1;
+    for (int c = 0; c < 256; ++c) {
+        if (regexClassHas(&regex->firstBytes, c)) {
+            regex->firstByte = (regex->firstByte == -1)? c : -2;
+        }
+    }
+    if (regex->firstByte == -2) {
+        regex->firstByte = -1;
+    }
+    return regex;
+}
+
+// Whether a match ends anywhere in the text. While no match is under way, 
+// the bytes no match can begin with are skipped without stepping the DFA.
+bool regexHasMatch(struct Regex *regex, const char *text, int len) {
+    struct Dfa *dfa = &regex->searchDfa;
+    int idle = dfaStart(dfa, false);
+    unsigned int flushAmt = dfa->flushAmt;
+    int state = dfaStart(dfa, true);
+
+    for (int i = 0; i < len; ++i) {
+        if (dfa->flushAmt != flushAmt) {
+            flushAmt = dfa->flushAmt;
+            idle = dfaStart(dfa, false);
+        }
+        if (dfa->states[state].accepting) {
+            return true;
+        }
+
+        if (state == idle) {
+            if (regex->firstByte != -1) {
+                const char *found = memchr(&text[i], regex->firstByte, len - i);
+                i = (found != NULL)? found - text : len;
+            }
+            else {
+                while (i < len && !regexClassHas(&regex->firstBytes, (unsigned char)text[i])) {
+                    i++;
+                }
+            }
+            if (i == len) {
+                break;
+            }
+        }
+
+        int next = dfa->states[state].next[(unsigned char)text[i]];
+        state = (next != DFA_UNKNOWN)? next : dfaStep(dfa, state, text[i]);
+    }
+    return dfa->states[state].accepting || dfa->states[state].acceptingAtEnd;
+}
+
+// Sets `starts[i]` for each position `i` from 0 to `len` where a match 
+// begins, by matching the reversed pattern backwards from the end of the 
+// text.
+void regexFindStarts(struct Regex *regex, const char *text, int len, bool *starts) {
+    struct Dfa *dfa = &regex->reverseDfa;
+    int state = dfaStart(dfa, true);
+    starts[len] = (len == 0)? dfa->states[state].acceptingAtEnd : dfa->states[state].accepting;
+
+    for (int i = len - 1; i >= 0; --i) {
+        // Take the steps that were already built without a call.
+        int next = dfa->states[state].next[(unsigned char)text[i]];
+        state = (next != DFA_UNKNOWN)? next : dfaStep(dfa, state, text[i]);
+        starts[i] = dfa->states[state].accepting;
+    }
+    if (len > 0) {
+        starts[0] = dfa->states[state].acceptingAtEnd;
+    }
+}
+
+// Returns the end of the longest match beginning at `start`, or -1 if no 
+// match begins there.
+int regexLongestMatch(struct Regex *regex, const char *text, int len, int start) {
+    struct Dfa *dfa = &regex->forwardDfa;
+    int state = dfaStart(dfa, start == 0);
+    int end = dfa->states[state].accepting? start : -1;
+
+    int i = start;
+    for (; i < len && !dfaIsDead(dfa, state); ++i) {
+        // Take the steps that were already built without a call.
+        int next = dfa->states[state].next[(unsigned char)text[i]];
+        state = (next != DFA_UNKNOWN)? next : dfaStep(dfa, state, text[i]);
+        if (dfa->states[state].accepting) {
+            end = i + 1;
+        }
+    }
+    if (i == len && dfa->states[state].acceptingAtEnd) {
+        end = len;
+    }
+    return end;
+}
+
+void regexNewMarks(struct Regex *regex) {
+    regex->markGeneration++;
+    if (regex->markGeneration == 0) {
+        memset(regex->stateMarks, 0, TERMINAL_EDITOR_DFA_MAX_STATES * sizeof(unsigned int));
+        regex->markGeneration = 1;
+    }
+}
+
+int regexNewRun(struct Regex *regex, int *runAmt, int lastAccept) {
+    if (*runAmt == regex->runCapacity) {
+        regex->runCapacity = (regex->runCapacity > 0)? regex->runCapacity * 2 : 64;
+        regex->runs = realloc(regex->runs, regex->runCapacity * sizeof(struct RegexRun));
+        regex->path = realloc(regex->path, regex->runCapacity * sizeof(int));
+        if (regex->runs == NULL || regex->path == NULL) {
+            die("realloc");
+        }
+    }
+    struct RegexRun *run = &regex->runs[*runAmt];
+    run->merged = -1;
+    run->mergedAt = 0;
+    run->lastAccept = lastAccept;
+    return (*runAmt)++;
+}
+
+// Flushes the forward DFA's cache, except for the states of the `activeAmt` 
+// runs still going on. Returns false if those take too much of the cache to 
+// step them all once more without it filling up.
+bool regexKeepActiveStates(struct Regex *regex, int activeAmt) {
+    struct Dfa *dfa = &regex->forwardDfa;
+    if (2 * activeAmt + 2 > TERMINAL_EDITOR_DFA_MAX_STATES) {
+        return false;
+    }
+
+    int *sets = malloc((activeAmt * dfa->nfa->stateAmt + 1) * sizeof(int));
+    int *setAmts = malloc((activeAmt + 1) * sizeof(int));
+    if (sets == NULL || setAmts == NULL) {
+        die("malloc");
+    }
+    for (int i = 0; i < activeAmt; ++i) {
+        struct DfaState *state = &dfa->states[regex->activeStates[i]];
+        memcpy(&sets[i * dfa->nfa->stateAmt], state->nfaStates, state->nfaStateAmt * sizeof(int));
+        setAmts[i] = state->nfaStateAmt;
+    }
+
+    dfaFlush(dfa);
+    regexNewMarks(regex);
+    for (int i = 0; i < activeAmt; ++i) {
+        memcpy(dfa->set, &sets[i * dfa->nfa->stateAmt], setAmts[i] * sizeof(int));
+        int state = dfaStateForSet(dfa, setAmts[i]);
+        regex->activeStates[i] = state;
+        regex->stateMarks[state] = regex->markGeneration;
+        regex->stateSlots[state] = i;
+    }
+    free(sets);
+    free(setAmts);
+    return true;
+}
+
+// Returns the end of the longest match beginning at `start`, whose run 
+// started at or was joined there at `run`, or -1 if no match begins there. 
+// The runs merged into others are pointed straight to the run they all 
+// ended up in along the way.
+int regexRunEnd(struct Regex *regex, int run, int start) {
+    struct RegexRun *runs = regex->runs;
+    int pathAmt = 0;
+    for (int at = run; runs[at].merged != -1; at = runs[at].merged) {
+        regex->path[pathAmt++] = at;
+    }
+
+    // A merged run only takes the accepting positions of the run it was 
+    // merged into from the position where that happened on.
+    for (int i = pathAmt - 2; i >= 0; --i) {
+        struct RegexRun *child = &runs[regex->path[i]];
+        struct RegexRun *parent = &runs[child->merged];
+        if (parent->lastAccept >= child->mergedAt) {
+            child->lastAccept = parent->lastAccept;
+        }
+        child->mergedAt = parent->mergedAt;
+        child->merged = parent->merged;
+    }
+
+    if (runs[run].merged != -1 && runs[runs[run].merged].lastAccept >= runs[run].mergedAt) {
+        return runs[runs[run].merged].lastAccept;
+    }
+    return (runs[run].lastAccept >= start)? runs[run].lastAccept : -1;
+}
+
+// Sets `ends[i]` to the end of the longest match beginning at `i`, or to -1, 
+// for each position `i` below `len` where `starts[i]` is set. The matches 
+// are followed in one pass over the text: a run of the DFA starts at each of 
+// those positions, and runs that reach the same state at the same position 
+// are merged, so at most one run per DFA state is stepped at a time. Only 
+// patterns that keep half of the DFA cache busy at once fall back to 
+// matching from each position in turn.
+void regexLongestMatches(struct Regex *regex, const char *text, int len, const bool *starts, int *ends) {
+    struct Dfa *dfa = &regex->forwardDfa;
+    int runAmt = 0;
+    int activeAmt = 0;
+    regexNewMarks(regex);
+
+    int i = 0;
+    while (i < len) {
+        // Skip ahead to where the next match begins while no run is going on.
+        if (activeAmt == 0 && !starts[i]) {
+            const bool *next = memchr(&starts[i], true, len - i);
+            if (next == NULL) {
+                break;
+            }
+            i = next - starts;
+        }
+
+        // A run going on by itself is stepped without merging until the 
+        // next match begins. Flushing the cache can't lose another's state.
+        if (activeAmt == 1 && !starts[i]) {
+            int run = regex->activeRuns[0];
+            int state = regex->activeStates[0];
+            while (i < len && !starts[i] && !dfaIsDead(dfa, state)) {
+                int next = dfa->states[state].next[(unsigned char)text[i]];
+                state = (next != DFA_UNKNOWN)? next : dfaStep(dfa, state, text[i]);
+                i++;
+                if ((i == len)? dfa->states[state].acceptingAtEnd : dfa->states[state].accepting) {
+                    regex->runs[run].lastAccept = i;
+                }
+            }
+            regexNewMarks(regex);
+            if (dfaIsDead(dfa, state)) {
+                activeAmt = 0;
+            }
+            else {
+                regex->activeStates[0] = state;
+                regex->stateMarks[state] = regex->markGeneration;
+                regex->stateSlots[state] = 0;
+            }
+            continue;
+        }
+
+        // Each run and a new one build at most one state each, which must 
+        // not flush the states of the others.
+        if (dfa->stateAmt + activeAmt + 2 > TERMINAL_EDITOR_DFA_MAX_STATES && !regexKeepActiveStates(regex, activeAmt)) {
+            for (int start = 0; start < len; ++start) {
+                if (starts[start]) {
+                    ends[start] = regexLongestMatch(regex, text, len, start);
+                }
+            }
+            return;
+        }
+
+        if (starts[i]) {
+            int state = dfaStart(dfa, i == 0);
+            if (regex->stateMarks[state] == regex->markGeneration) {
+                ends[i] = regex->activeRuns[regex->stateSlots[state]];
+            }
+            else {
+                ends[i] = regexNewRun(regex, &runAmt, dfa->states[state].accepting? i : -1);
+                regex->activeRuns[activeAmt] = ends[i];
+                regex->activeStates[activeAmt++] = state;
+            }
+        }
+
+        // Step every run, dropping the dead ones and merging the ones that 
+        // end up in the same state.
+        regexNewMarks(regex);
+        int keptAmt = 0;
+        for (int j = 0; j < activeAmt; ++j) {
+            int run = regex->activeRuns[j];
+            int state = regex->activeStates[j];
+            int next = dfa->states[state].next[(unsigned char)text[i]];
+            state = (next != DFA_UNKNOWN)? next : dfaStep(dfa, state, text[i]);
+            if (dfaIsDead(dfa, state)) {
+                continue;
+            }
+            if ((i + 1 == len)? dfa->states[state].acceptingAtEnd : dfa->states[state].accepting) {
+                regex->runs[run].lastAccept = i + 1;
+            }
+            if (regex->stateMarks[state] == regex->markGeneration) {
+                regex->runs[run].merged = regex->activeRuns[regex->stateSlots[state]];
+                regex->runs[run].mergedAt = i + 1;
+                continue;
+            }
+            regex->stateMarks[state] = regex->markGeneration;
+            regex->stateSlots[state] = keptAmt;
+            regex->activeRuns[keptAmt] = run;
+            regex->activeStates[keptAmt++] = state;
+        }
+        activeAmt = keptAmt;
+        i++;
+    }
+
+    const bool *start = memchr(starts, true, len);
+    while (start != NULL) {
+        int at = start - starts;
+        ends[at] = regexRunEnd(regex, ends[at], at);
+        start = memchr(start + 1, true, len - at - 1);
+    }
+}
+
+/*
+ * Search engine.
+ *
+ * Finds occurrences of a literal pattern in row text. Candidate positions 
+ * are found by comparing the first and last bytes of the pattern against a 
+ * whole block of text at once, and only the candidates are compared in full.
+ * Text too short for a block is searched with Horspool's algorithm.
+ */
+
+void searchFreePattern(struct SearchPattern *pattern) {
+    free(pattern->text);
+    pattern->text = NULL;
+    regexFree(pattern->regex);
+    pattern->regex = NULL;
+    free(pattern->starts);
+    pattern->starts = NULL;
+    free(pattern->ends);
+    pattern->ends = NULL;
+}
+
+void searchCompile(struct SearchPattern *pattern, const char *query, int flags) {
+    pattern->len = strlen(query);
+    pattern->flags = flags;
+
+    pattern->regex = NULL;
+    pattern->error = NULL;
+    pattern->starts = NULL;
+    pattern->ends = NULL;
+    pattern->startsCapacity = 0;
+    if ((flags & SEARCH_REGEX) && pattern->len > 0) {
+        pattern->regex = regexCompile(query, flags & SEARCH_IGNORE_CASE, &pattern->error);
+    }
+
+    pattern->text = malloc(pattern->len + 1);
+    if (pattern->text == NULL) {
+        die("malloc");
+    }
+    for (int i = 0; i <= pattern->len; ++i) {
+        pattern->text[i] = (flags & SEARCH_IGNORE_CASE)? tolower((unsigned char)query[i]) : query[i];
+    }
+
+    for (int c = 0; c < 256; ++c) {
+        pattern->shift[c] = pattern->len;
+    }
+    for (int i = 0; i < pattern->len - 1; ++i) {
+        unsigned char c = pattern->text[i];
+        pattern->shift[c] = pattern->len - 1 - i;
+        if (flags & SEARCH_IGNORE_CASE) {
+            pattern->shift[toupper(c)] = pattern->len - 1 - i;
+        }
+    }
+}
+
+// Whether the pattern occurs in `text` at `at`.
+bool searchMatchesAt(const struct SearchPattern *pattern, const char *text, int at) {
+    if (!(pattern->flags & SEARCH_IGNORE_CASE)) {
+        return memcmp(&text[at], pattern->text, pattern->len) == 0;
+    }
+    for (int i = 0; i < pattern->len; ++i) {
+        if (tolower((unsigned char)text[at + i]) != (unsigned char)pattern->text[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the offset of the first occurrence of the pattern in the `len` 
+// bytes of `text` starting at `from`, or -1 if there is none. Word 
+// boundaries are not considered.
+int searchFindAny(const struct SearchPattern *pattern, const char *text, int len, int from) {
+    int last = pattern->len - 1;
+    int i = from;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    // When ignoring case, letters are compared with their lowercase bit set.
+    unsigned char firstByte = pattern->text[0];
+    unsigned char lastByte = pattern->text[last];
+    char firstFold = ((pattern->flags & SEARCH_IGNORE_CASE) && isalpha(firstByte))? 0x20 : 0;
+    char lastFold = ((pattern->flags & SEARCH_IGNORE_CASE) && isalpha(lastByte))? 0x20 : 0;
+#endif
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(firstByte);
+    const __m256i lastChar = _mm256_set1_epi8(lastByte);
+    const __m256i firstMask = _mm256_set1_epi8(firstFold);
+    const __m256i lastMask = _mm256_set1_epi8(lastFold);
+    for (; i + last + 32 <= len; i += 32) {
+        __m256i blockFirst = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&text[i]), firstMask);
+        __m256i blockLast = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&text[i + last]), lastMask);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, lastChar)));
+
+        while (mask != 0) {
+            int at = i + __builtin_ctz(mask);
+            if (searchMatchesAt(pattern, text, at)) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(firstByte);
+    const __m128i lastChar = _mm_set1_epi8(lastByte);
+    const __m128i firstMask = _mm_set1_epi8(firstFold);
+    const __m128i lastMask = _mm_set1_epi8(lastFold);
+    for (; i + last + 16 <= len; i += 16) {
+        __m128i blockFirst = _mm_or_si128(_mm_loadu_si128((const __m128i *)&text[i]), firstMask);
+        __m128i blockLast = _mm_or_si128(_mm_loadu_si128((const __m128i *)&text[i + last]), lastMask);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, lastChar)));
+
+        while (mask != 0) {
+            int at = i + __builtin_ctz(mask);
+            if (searchMatchesAt(pattern, text, at)) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while (i + last < len) {
+        if (searchMatchesAt(pattern, text, i)) {
+            return i;
+        }
+        i += pattern->shift[(unsigned char)text[i + last]];
+    }
+    return -1;
+}
+
+// Whether the text from `start` to `end` is not part of a longer word, or 
+// the pattern does not need it to be.
+bool searchIsWholeWord(const struct SearchPattern *pattern, const char *text, int len, int start, int end) {
+    if (!(pattern->flags & SEARCH_WHOLE_WORD)) {
+        return true;
+    }
+    bool wordStart = (start == 0 || !isWordChar((unsigned char)text[start - 1]));
+    bool wordEnd = (end == len || !isWordChar((unsigned char)text[end]));
+    return wordStart && wordEnd;
+}
+
+// Returns the offset of the first match of the pattern in the `len` bytes 
+// of `text` starting at `from`, or -1 if there is none.
+int searchFind(const struct SearchPattern *pattern, const char *text, int len, int from) {
+    if (pattern->len == 0) {
+        return -1;
+    }
+
+    // Skip over the occurrences that are part of a longer word.
+    int at = searchFindAny(pattern, text, len, from);
+    while (at != -1 && !searchIsWholeWord(pattern, text, len, at, at + pattern->len)) {
+        at = searchFindAny(pattern, text, len, at + 1);
+    }
+    return at;
+}
+
+/*
+ * Search index.
+ *
+ * Keeps every match of the current search query in row order, so stepping 
+ * between matches and counting them never rescans the text. Typing another 
+ * character of the query only re-verifies the previous matches, and edits 
+ * only rescan the rows they changed, or the text around them in long rows.
+ */
+
+void searchIndexReserve(struct SearchIndex *search, int matchAmt) {
+    if (matchAmt <= search->matchCapacity) {
+        return;
+    }
+    int capacity = (search->matchCapacity > 0)? search->matchCapacity * 2 : 64;
+    while (capacity < matchAmt) {
+        capacity *= 2;
+    }
+    search->matches = realloc(search->matches, capacity * sizeof(struct SearchMatch));
+    if (search->matches == NULL) {
+        die("realloc");
+    }
+    search->matchCapacity = capacity;
+}
+
+void searchAddMatch(struct SearchMatch **out, int *outAmt, int *outCapacity, int fileRow, int col, int len) {
+    if (*outAmt == *outCapacity) {
+        *outCapacity = (*outCapacity > 0)? *outCapacity * 2 : 16;
+        *out = realloc(*out, *outCapacity * sizeof(struct SearchMatch));
+        if (*out == NULL) {
+            die("realloc");
+        }
+    }
+    (*out)[*outAmt].row = fileRow;
+    (*out)[*outAmt].col = col;
+    (*out)[*outAmt].len = len;
+    (*outAmt)++;
+}
+
+// Appends the matches of a regular expression in the row that begin at or 
+// after `from`. Rows without a match are ruled out with a forward pass 
+// first. Otherwise, the positions where matches begin are all found in one 
+// backwards pass, and where the longest match from each of them ends in one 
+// forward pass. Matches don't overlap, and empty matches are skipped since 
+// there is nothing to show for them.
+void searchScanRowRegex(struct SearchPattern *pattern, const char *text, int len, int from, int fileRow, 
+    struct SearchMatch **out, int *outAmt, int *outCapacity) {
+    if (len + 1 > pattern->startsCapacity) {
+        pattern->startsCapacity = len + 1;
+        pattern->starts = realloc(pattern->starts, pattern->startsCapacity * sizeof(bool));
+        pattern->ends = realloc(pattern->ends, pattern->startsCapacity * sizeof(int));
+        if (pattern->starts == NULL || pattern->ends == NULL) {
+            die("realloc");
+        }
+    }
+    bool *starts = pattern->starts;
+    int *ends = pattern->ends;
+
+    if (!regexHasMatch(pattern->regex, text, len)) {
+        return;
+    }
+    regexFindStarts(pattern->regex, text, len, starts);
+    regexLongestMatches(pattern->regex, text, len, starts, ends);
+
+    int at = from;
+    while (at < len) {
+        int end = starts[at]? ends[at] : -1;
+        if (end > at && searchIsWholeWord(pattern, text, len, at, end)) {
+            searchAddMatch(out, outAmt, outCapacity, fileRow, at, end - at);
+            at = end;
+        }
+        else {
+            at++;
+        }
+    }
+}
 
-                if (!strncmp(&row->render[i], keywords[j], keywordLen) && 
-                    isSeparator(row->render[i + keywordLen])) {
-                    memset(&row->highlight[i], isSecondaryKw ? HL_KEYWORD2 : HL_KEYWORD1, keywordLen);
-                    i += keywordLen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL) {
-                prevWasSep = false;
-                continue;
-            }
+// Appends the matches in the row to `out`, which holds `*outAmt` matches 
+// and room for `*outCapacity`.
+void searchScanRow(struct SearchPattern *pattern, struct TextRow *row, int fileRow, 
+    struct SearchMatch **out, int *outAmt, int *outCapacity) {
+    char *copy;
+    const char *text = editorRowCharsView(row, &copy);
+
+    if (pattern->flags & SEARCH_REGEX) {
+        if (pattern->regex != NULL) {
+            searchScanRowRegex(pattern, text, row->size, 0, fileRow, out, outAmt, outCapacity);
         }
+    }
+    else {
+        // Like regex matches, literal matches don't overlap.
+        for (int at = searchFind(pattern, text, row->size, 0); at != -1; 
+            at = searchFind(pattern, text, row->size, at + pattern->len)) {
+            searchAddMatch(out, outAmt, outCapacity, fileRow, at, pattern->len);
+        }
+    }
+    free(copy);
+}
 
-        prevWasSep = isSeparator(c);
-        i++;
+// Returns the row's characters from `*at` up to `*end`, which are clamped to 
+// the row first. They are only copied when the gap of a long row is in 
+// between, and the copy stays valid until the next call.
+const char *searchRowWindow(struct TextRow *row, int *at, int *end) {
+    static char *window = NULL;
+    static int windowCapacity = 0;
+
+    if (*at < 0) {
+        *at = 0;
+    }
+    if (*end > row->size) {
+        *end = row->size;
+    }
+    struct LongRow *longRow = row->longRow;
+    if (longRow == NULL || *end <= longRow->gapStart) {
+        return &row->chars[*at];
+    }
+    if (*at >= longRow->gapStart) {
+        return &row->chars[*at + longRow->gapLen];
     }
 
-    bool commentStateChanged = (row->partOfMultiLineComment != inComment);
-    row->partOfMultiLineComment = inComment;
+    int len = *end - *at;
+    if (len + 1 > windowCapacity) {
+        windowCapacity = len + 1;
+        window = realloc(window, windowCapacity);
+        if (window == NULL) {
+            die("realloc");
+        }
+    }
+    editorRowCopyChars(row, *at, len, window);
+    window[len] = '\0';
+    return window;
+}
 
-    if (commentStateChanged && row->idx + 1 < editor.rowAmt) {
-        editorUpdateSyntax(&editor.rows[row->idx + 1]);
+// Appends the literal matches in the row that begin from `from` up to 
+// `limit`, and returns where the next one could begin. Only the text they 
+// can cover and the characters around it are looked at.
+int searchScanLiteralRange(struct SearchPattern *pattern, struct TextRow *row, int fileRow, int from, 
+    int limit, struct SearchMatch **out, int *outAmt, int *outCapacity) {
+    if (from >= limit) {
+        return from;
     }
+    int start = from - 1;
+    int end = limit + pattern->len;
+    const char *text = searchRowWindow(row, &start, &end);
+    int len = end - start;
+
+    for (int at = searchFind(pattern, text, len, from - start); at != -1 && start + at < limit; 
+        at = searchFind(pattern, text, len, at + pattern->len)) {
+        searchAddMatch(out, outAmt, outCapacity, fileRow, start + at, pattern->len);
+        from = start + at + pattern->len;
+    }
+    return from;
 }
 
-int editorSyntaxToColor(int highlightType) {
-    switch (highlightType) {
-        case HL_COMMENT: 
-        case HL_MULTILINE_COMMENT: return 36;
-        case HL_KEYWORD1: return 33;
-        case HL_KEYWORD2: return 32;
-        case HL_STRING: return 35;
-        case HL_NUMBER: return 31;
-        case HL_MATCH: return 34;
-        default: return 37;
+// Returns the index of the first match at or after the given position.
+int searchIndexLowerBound(struct SearchIndex *search, int fileRow, int col) {
+    int low = 0;
+    int high = search->matchAmt;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        struct SearchMatch *match = &search->matches[mid];
+        if (match->row < fileRow || (match->row == fileRow && match->col < col)) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
     }
+    return low;
 }
 
-void editorSelectSyntaxHighlight() {
-    editor.syntax = NULL;
-    if (editor.filename == NULL) {
+// Selects the first match at or after the given position, wrapping around 
+// to the first match.
+void searchIndexSeek(struct SearchIndex *search, int fileRow, int col) {
+    if (search->matchAmt == 0) {
+        search->current = -1;
         return;
     }
+    search->current = searchIndexLowerBound(search, fileRow, col) % search->matchAmt;
+}
 
-    char *fileExt = strchr(editor.filename, '.');
-
-    for (unsigned int i = 0; i < HIGHLIGHT_DB_ENTRIES; ++i) {
-        struct EditorSyntax *syntax = &highlightDb[i];
+// Selects the next match, or the previous one when `direction` is -1.
+void searchIndexStep(struct SearchIndex *search, int direction) {
+    if (search->matchAmt == 0) {
+        return;
+    }
+    search->current = (search->current + direction + search->matchAmt) % search->matchAmt;
+}
 
-        unsigned int j = 0;
-        while (syntax->fileMatch[j]) {
-            int isExt = (syntax->fileMatch[j][0] == '.');
+void searchIndexClear(struct SearchIndex *search) {
+    search->active = false;
+    free(search->query);
+    search->query = NULL;
+    searchFreePattern(&search->pattern);
+    search->matchAmt = 0;
+    search->current = -1;
+}
 
-            if ((isExt && fileExt && !strcmp(fileExt, syntax->fileMatch[j])) || 
-                (!isExt && strstr(editor.filename, syntax->fileMatch[j]))) {
-                editor.syntax = syntax;
+void *searchWorkerMain(void *arg) {
+    struct SearchPool *pool = arg;
+    struct SearchPattern pattern = { .text = NULL, .regex = NULL, .starts = NULL, .ends = NULL };
+    unsigned int generation = 0;
 
-                // Re-highlight all the file's rows after a syntax highlighting 
-                // scheme is determined.
-                for (int fileRow = 0; fileRow < editor.rowAmt; ++fileRow) {
-                    editorUpdateSyntax(&editor.rows[fileRow]);
-                }
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->canceled || pool->dispatchedAmt == pool->chunkAmt) {
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+        int index = (pool->firstChunk + pool->dispatchedAmt++) % pool->chunkAmt;
+        struct SearchChunk *chunk = &pool->chunks[index];
+        bool recompile = (pool->generation != generation);
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        // The query stays the same until every handed out chunk is done.
+        if (recompile) {
+            searchFreePattern(&pattern);
+            searchCompile(&pattern, pool->query, pool->flags);
+        }
 
-                return;
+        chunk->matchAmt = 0;
+        struct RowIter it = editorRowIterAt(chunk->startRow);
+        for (int fileRow = chunk->startRow; fileRow < chunk->endRow; ++fileRow) {
+            if (__atomic_load_n(&pool->canceled, __ATOMIC_RELAXED)) {
+                break;
             }
-            j++;
+            searchScanRow(&pattern, editorRowIterNext(&it), fileRow, 
+                &chunk->matches, &chunk->matchAmt, &chunk->matchCapacity);
         }
+
+        pthread_mutex_lock(&pool->lock);
+        chunk->done = true;
+        pool->doneAmt++;
+        pthread_cond_signal(&pool->chunkDone);
     }
+    return NULL;
 }
 
-/*
- * Row operations
- */
+void searchPoolStart(struct SearchPool *pool) {
+    if (pool->threadAmt > 0) {
+        return;
+    }
+    long threadAmt = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threadAmt < 1) {
+        threadAmt = 1;
+    }
+    else if (threadAmt > TERMINAL_EDITOR_SEARCH_MAX_THREADS) {
+        threadAmt = TERMINAL_EDITOR_SEARCH_MAX_THREADS;
+    }
 
-// Converts an index into the row's real backing character array 
-// `row.chars` into an index into the row's rendereed character array 
-// `row.render`.
-int editorCursorXRealToRender(struct TextRow *row, int cursorX) {
-    int renderCursorX = 0;
-    
-    for (int i = 0; i < cursorX; i++) {
-        if (row->chars[i] == '\t') {
-            renderCursorX += (TERMINAL_EDITOR_TAB_SIZE - 1) - (renderCursorX % TERMINAL_EDITOR_TAB_SIZE);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->chunkDone, NULL);
+    for (int i = 0; i < threadAmt; ++i) {
+        if (pthread_create(&pool->threads[i], NULL, searchWorkerMain, pool) != 0) {
+            die("pthread_create");
         }
-        renderCursorX++;
     }
-    return renderCursorX;
+    pool->threadAmt = threadAmt;
 }
 
-// Does the same thing as `editorCursorXRealToRender` but in the other 
-// direction where it turns a `row.render` index into a `row.chars` index.
-int editorRenderCursorXToReal(struct TextRow *row, int renderCursorX) {
-    int currRenderCursorX = 0;
-    
-    for (int cursorX = 0; cursorX < row->size; ++cursorX) {
-        if (row->chars[cursorX] == '\t') {
-            currRenderCursorX += (TERMINAL_EDITOR_TAB_SIZE - 1) - (currRenderCursorX % TERMINAL_EDITOR_TAB_SIZE);
+// Finds the first match at or after the origin of the search among the 
+// chunks scanned so far. It is only known once every chunk handed out 
+// before the one it's in is done. Called with the pool's lock held.
+struct SearchMatch *searchPoolFirstMatch(struct SearchPool *pool, int originRow, int originCol) {
+    for (int i = 0; i < pool->chunkAmt; ++i) {
+        struct SearchChunk *chunk = &pool->chunks[(pool->firstChunk + i) % pool->chunkAmt];
+        if (!chunk->done) {
+            return NULL;
         }
-        currRenderCursorX++;
-
-        if (currRenderCursorX > renderCursorX) {
-            return cursorX;
+        for (int j = 0; j < chunk->matchAmt; ++j) {
+            struct SearchMatch *match = &chunk->matches[j];
+            if (i > 0 || match->row > originRow || (match->row == originRow && match->col >= originCol)) {
+                return match;
+            }
         }
     }
-    return row->size; // unreachable
+    // Wrap around to the matches before the origin.
+    struct SearchChunk *chunk = &pool->chunks[pool->firstChunk];
+    return (chunk->matchAmt > 0)? &chunk->matches[0] : NULL;
 }
 
-void editorUpdateRow(struct TextRow *row) {
-    // Count the number of tabs in the row.
-    int tabAmt = 0;
-    for (int i = 0; i < row->size; i++) {
-        if (row->chars[i] == '\t') {
-            tabAmt++;
+// Scans every row for the query with the worker pool, and merges the 
+// matches of the chunks in row order. The main thread waits for the scan, 
+// showing the first match after the origin as soon as it's found. Drawing 
+// it leaves what the workers read alone, since rows are already long rows 
+// if they are long enough to be. The scan is canceled, returning false, 
+// when input arrives in the meantime.
+bool searchIndexScanParallel(struct SearchIndex *search) {
+    struct SearchPool *pool = &search->pool;
+    searchPoolStart(pool);
+
+    int chunkAmt = (editor.rowAmt + TERMINAL_EDITOR_SEARCH_CHUNK_ROWS - 1) / TERMINAL_EDITOR_SEARCH_CHUNK_ROWS;
+    if (chunkAmt > pool->chunkCapacity) {
+        pool->chunks = realloc(pool->chunks, chunkAmt * sizeof(struct SearchChunk));
+        if (pool->chunks == NULL) {
+            die("realloc");
+        }
+        for (int i = pool->chunkCapacity; i < chunkAmt; ++i) {
+            pool->chunks[i].matches = NULL;
+            pool->chunks[i].matchCapacity = 0;
         }
+        pool->chunkCapacity = chunkAmt;
+    }
+    for (int i = 0; i < chunkAmt; ++i) {
+        struct SearchChunk *chunk = &pool->chunks[i];
+        chunk->startRow = i * TERMINAL_EDITOR_SEARCH_CHUNK_ROWS;
+        chunk->endRow = chunk->startRow + TERMINAL_EDITOR_SEARCH_CHUNK_ROWS;
+        if (chunk->endRow > editor.rowAmt) {
+            chunk->endRow = editor.rowAmt;
+        }
+        chunk->matchAmt = 0;
+        chunk->done = false;
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabAmt*(TERMINAL_EDITOR_TAB_SIZE - 1) + 1);
-
-    int renderIdx = 0;
+    editorSearchProgress(NULL);
 
-    for (int i = 0; i < row->size; i++) {
-        // Simulate tab spacing by adding spaces until the row index is a 
-        // multiple of the tab size.
-        if (row->chars[i] == '\t') {
-            row->render[renderIdx++] = ' ';
-            while (renderIdx % TERMINAL_EDITOR_TAB_SIZE != 0) {
-                row->render[renderIdx++] = ' ';
+    pthread_mutex_lock(&pool->lock);
+    pool->query = search->query;
+    pool->flags = search->flags;
+    pool->generation++;
+    pool->chunkAmt = chunkAmt;
+    pool->firstChunk = search->originRow / TERMINAL_EDITOR_SEARCH_CHUNK_ROWS;
+    if (pool->firstChunk >= chunkAmt) {
+        pool->firstChunk = 0;
+    }
+    pool->dispatchedAmt = 0;
+    pool->doneAmt = 0;
+    __atomic_store_n(&pool->canceled, false, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&pool->workReady);
+
+    bool shown = false;
+    while (pool->doneAmt < (pool->canceled? pool->dispatchedAmt : pool->chunkAmt)) {
+        if (!pool->canceled && editorInputPending()) {
+            __atomic_store_n(&pool->canceled, true, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!shown && !pool->canceled) {
+            struct SearchMatch *first = searchPoolFirstMatch(pool, search->originRow, search->originCol);
+            if (first != NULL) {
+                struct SearchMatch match = *first;
+                shown = true;
+                pthread_mutex_unlock(&pool->lock);
+                editorSearchProgress(&match);
+                pthread_mutex_lock(&pool->lock);
+                continue;
             }
         }
-        else {
-            row->render[renderIdx++] = row->chars[i];
+
+        // Wake up now and then to notice input.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 10 * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
+        pthread_cond_timedwait(&pool->chunkDone, &pool->lock, &deadline);
     }
-    row->render[renderIdx] = '\0';
-    row->renderSize = renderIdx;
+    bool canceled = pool->canceled;
+    pthread_mutex_unlock(&pool->lock);
 
-    editorUpdateSyntax(row);
+    if (canceled) {
+        return false;
+    }
+    int matchAmt = 0;
+    for (int i = 0; i < chunkAmt; ++i) {
+        matchAmt += pool->chunks[i].matchAmt;
+    }
+    searchIndexReserve(search, matchAmt);
+    search->matchAmt = 0;
+    for (int i = 0; i < chunkAmt; ++i) {
+        struct SearchChunk *chunk = &pool->chunks[i];
+        memcpy(&search->matches[search->matchAmt], chunk->matches, chunk->matchAmt * sizeof(struct SearchMatch));
+        search->matchAmt += chunk->matchAmt;
+    }
+    return true;
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at < 0 || at > editor.rowAmt) {
-        return;
+// Makes `query` the searched query. When it extends the previous query 
+// with the same modes, only the text at and around the previous matches 
+// is searched again: the longer query occurs only where the previous one 
+// does, and every occurrence of the previous one begins within a match of 
+// it, since matches don't overlap. Whole word matches of the longer query 
+// need not be whole word matches of the previous one, and regular 
+// expressions don't narrow down that way, so those searches always rescan. 
+// Large buffers are scanned in parallel, and the scan stops when input 
+// arrives. Returns false in that case, leaving the index inactive so the 
+// next query rescans.
+bool searchIndexSetQuery(struct SearchIndex *search, const char *query, int flags) {
+    if (search->active && search->flags == flags && strcmp(query, search->query) == 0) {
+        return true;
     }
 
-    editor.rows = realloc(editor.rows, sizeof(struct TextRow) * (editor.rowAmt + 1));
-    memmove(&editor.rows[at + 1], &editor.rows[at], sizeof(struct TextRow) * (editor.rowAmt - at));
+    int queryLen = strlen(query);
+    bool narrow = search->active && search->flags == flags 
+        && !(flags & (SEARCH_WHOLE_WORD | SEARCH_REGEX)) 
+        && search->pattern.len > 0 && queryLen > search->pattern.len 
+        && strncmp(query, search->query, search->pattern.len) == 0;
+
+    searchFreePattern(&search->pattern);
+    searchCompile(&search->pattern, query, flags);
+    free(search->query);
+    search->query = strdup(query);
+    search->flags = flags;
+    search->active = true;
+
+    if (narrow) {
+        struct SearchMatch *kept = NULL;
+        int keptAmt = 0;
+        int keptCapacity = 0;
+
+        // The matches are in row order, so their rows are mostly reached by 
+        // walking forward from the last one instead of looking them up.
+        struct RowIter it;
+        int nextRow = INT_MAX;
+        struct TextRow *row = NULL;
+        int from = 0;
+        for (int i = 0; i < search->matchAmt; ++i) {
+            struct SearchMatch *match = &search->matches[i];
+            if (i == 0 || match->row != search->matches[i - 1].row) {
+                if (match->row < nextRow || match->row - nextRow > ROW_LEAF_CAPACITY) {
+                    it = editorRowIterAt(match->row);
+                    nextRow = match->row;
+                }
+                while (nextRow <= match->row) {
+                    row = editorRowIterNext(&it);
+                    nextRow++;
+                }
+                from = 0;
+            }
 
-    // Update the indices of the rows after this row.
-    for (int i = at + 1; i <= editor.rowAmt; ++i) {
-        editor.rows[i].idx++;
+            // Check whether the longer query matches where the match begins, 
+            // and otherwise look for it where the occurrences the match 
+            // covered begin.
+            int start = (from > match->col)? from : match->col;
+            if (start == match->col) {
+                int end = start + search->pattern.len;
+                const char *text = searchRowWindow(row, &start, &end);
+                if (end - start == search->pattern.len && searchMatchesAt(&search->pattern, text, 0)) {
+                    searchAddMatch(&kept, &keptAmt, &keptCapacity, match->row, start, search->pattern.len);
+                    from = end;
+                    continue;
+                }
+                start++;
+            }
+            from = searchScanLiteralRange(&search->pattern, row, match->row, start, 
+                match->col + match->len, &kept, &keptAmt, &keptCapacity);
+        }
+        free(search->matches);
+        search->matches = kept;
+        search->matchAmt = keptAmt;
+        search->matchCapacity = keptCapacity;
     }
+    else if (queryLen > 0 && search->pattern.error == NULL && editor.rowAmt > TERMINAL_EDITOR_SEARCH_CHUNK_ROWS) {
+        if (!searchIndexScanParallel(search)) {
+            search->active = false;
+            search->matchAmt = 0;
+            search->current = -1;
+            return false;
+        }
+    }
+    else {
+        search->matchAmt = 0;
+        if (queryLen > 0) {
+            struct RowIter it = editorRowIterAt(0);
+            struct TextRow *row;
+            for (int fileRow = 0; (row = editorRowIterNext(&it)) != NULL; ++fileRow) {
+                searchScanRow(&search->pattern, row, fileRow, 
+                    &search->matches, &search->matchAmt, &search->matchCapacity);
+            }
+        }
+    }
+    searchIndexSeek(search, search->originRow, search->originCol);
+    return true;
+}
 
-    editor.rows[at].idx = at;
-
-    editor.rows[at].size = len;
-    editor.rows[at].chars = malloc(len + 1);
-    memcpy(editor.rows[at].chars, s, len);
-    editor.rows[at].chars[len] = '\0';
+// Replaces the matches from `start` up to `end` with `amt` matches.
+void searchIndexSplice(struct SearchIndex *search, int start, int end, struct SearchMatch *matches, int amt) {
+    int removedAmt = end - start;
+    if (removedAmt == 0 && amt == 0) {
+        return;
+    }
 
-    editor.rows[at].renderSize = 0;
-    editor.rows[at].render = NULL;
-    editor.rows[at].highlight = NULL;
+    searchIndexReserve(search, search->matchAmt - removedAmt + amt);
+    memmove(&search->matches[start + amt], &search->matches[end], 
+        (search->matchAmt - end) * sizeof(struct SearchMatch));
+    if (amt > 0) {
+        memcpy(&search->matches[start], matches, amt * sizeof(struct SearchMatch));
+    }
+    search->matchAmt += amt - removedAmt;
 
-    editor.rows[at].partOfMultiLineComment = false;
+    // Keep the same match selected when it comes after the replaced ones.
+    if (search->current >= end) {
+        search->current += amt - removedAmt;
+    }
+    else if (search->current >= start + amt) {
+        search->current = start + amt;
+    }
+    if (search->current == -1 || search->current >= search->matchAmt) {
+        search->current = (search->matchAmt > 0)? 0 : -1;
+    }
+}
 
-    editorUpdateRow(&editor.rows[at]);
+// Replaces the matches of the row with the ones found in its current text.
+void searchIndexRescanRow(struct SearchIndex *search, int fileRow) {
+    static struct SearchMatch *found = NULL;
+    static int foundCapacity = 0;
+    int foundAmt = 0;
 
-    editor.rowAmt++;
-    editor.isDirty = true;
-}
+    searchScanRow(&search->pattern, editorRowAt(fileRow), fileRow, &found, &foundAmt, &foundCapacity);
 
-void editorFreeRow(struct TextRow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->highlight);
+    int start = searchIndexLowerBound(search, fileRow, 0);
+    int end = searchIndexLowerBound(search, fileRow + 1, 0);
+    searchIndexSplice(search, start, end, found, foundAmt);
 }
 
-void editorDeleteRow(int at) {
-    if (at < 0 || at >= editor.rowAmt) {
-        return;
+// Updates the literal matches of a long row after `oldLen` characters at 
+// `at` were replaced with `newLen` ones. The matches that end before the 
+// edit stay, and the rescan from there stops as soon as it lines up with 
+// the matches after the edit, which only move. Without a match that 
+// overlaps it, that is within a pattern length of the edit.
+void searchIndexEditLiteral(struct SearchIndex *search, int fileRow, int at, int oldLen, int newLen) {
+    static struct SearchMatch *found = NULL;
+    static int foundCapacity = 0;
+    int foundAmt = 0;
+
+    struct SearchPattern *pattern = &search->pattern;
+    struct SearchMatch *matches = search->matches;
+    int patternLen = pattern->len;
+    int delta = newLen - oldLen;
+
+    // Whole-word matches also depend on the characters next to them.
+    int context = (pattern->flags & SEARCH_WHOLE_WORD)? 1 : 0;
+    int editStart = at - context;
+    int editEnd = at + oldLen + context;
+
+    // Matches from `start` up to `end` touch the edit.
+    int start = searchIndexLowerBound(search, fileRow, editStart - patternLen + 1);
+    int end = searchIndexLowerBound(search, fileRow, editEnd);
+    int rowEnd = searchIndexLowerBound(search, fileRow + 1, 0);
+
+    // No match can begin between the previous match and the edit, since the 
+    // scan would have found it before. After the edit, the text didn't 
+    // change, so none can begin before the next match there either, except 
+    // where the text was covered by a match that touched the edit.
+    int from = editStart - patternLen + 1;
+    if (start > 0 && matches[start - 1].row == fileRow && matches[start - 1].col + patternLen > from) {
+        from = matches[start - 1].col + patternLen;
     }
-    editorFreeRow(&editor.rows[at]);
-    memmove(&editor.rows[at], &editor.rows[at + 1], sizeof(struct TextRow) * (editor.rowAmt - at - 1));
-    
-    // Update the indeces of the rows after the row to be deleted.
-    for (int i = at; i < editor.rowAmt - 1; ++i) {
-        editor.rows[i].idx--;
+    if (from < 0) {
+        from = 0;
     }
-    
-    editor.rowAmt--;
-    editor.isDirty = true;
-}
-
-void editorInsertCharIntoRow(struct TextRow *row, int at, int ch) {
-    if (at < 0 || at > row->size) {
-        at = row->size;
+    int limit = editEnd + delta;
+    if (end > start && matches[end - 1].col + patternLen > editEnd) {
+        limit = matches[end - 1].col + patternLen + delta;
     }
-    row->chars = realloc(row->chars, row->size + 2);
 
-    // Move the portion of the row at/after `at` by 1 to make room for 
-    // inserting `ch` at `row->chars[at]`. 
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    for (int i = end; i < rowEnd; ++i) {
+        matches[i].col += delta;
+    }
 
-    row->size++;
-    row->chars[at] = ch;
-    editorUpdateRow(row);
-    editor.isDirty = true;
+    // Once a new match covers where an old one began, the text the old one 
+    // covered has to be scanned too.
+    int next = end;
+    struct TextRow *row = editorRowAt(fileRow);
+    while (true) {
+        from = searchScanLiteralRange(pattern, row, fileRow, from, limit, &found, &foundAmt, &foundCapacity);
+        if (next == rowEnd || matches[next].col >= from) {
+            break;
+        }
+        while (next < rowEnd && matches[next].col < from) {
+            if (matches[next].col + patternLen > limit) {
+                limit = matches[next].col + patternLen;
+            }
+            next++;
+        }
+    }
+    searchIndexSplice(search, start, next, found, foundAmt);
 }
 
-void editorAppendStringToRow(struct TextRow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    editor.isDirty = true;
-}
+// Updates the regular expression matches of a long row after `oldLen` 
+// characters at `at` were replaced with `newLen` ones, by rescanning only 
+// TERMINAL_EDITOR_SEARCH_REGEX_SPAN bytes on each side of the edit.
+void searchIndexEditRegex(struct SearchIndex *search, int fileRow, int at, int oldLen, int newLen) {
+    static struct SearchMatch *found = NULL;
+    static int foundCapacity = 0;
+    int foundAmt = 0;
 
-void editorDeleteCharFromRow(struct TextRow *row, int at) {
-    if (at < 0 || at >= row->size) {
+    struct SearchPattern *pattern = &search->pattern;
+    if (pattern->regex == NULL) {
         return;
     }
-    // Shift everything after `at` back one index to delete the character at 
-    // index `at`.
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    editor.isDirty = true;
-}
-
-/*
- * Editor operations.
- */
-
-void editorInsertChar(int ch) {
-    if (editor.cursorY == editor.rowAmt) {
-        editorInsertRow(editor.rowAmt, "", 0);
+    struct SearchMatch *matches = search->matches;
+    struct TextRow *row = editorRowAt(fileRow);
+    int delta = newLen - oldLen;
+
+    int windowStart = at - TERMINAL_EDITOR_SEARCH_REGEX_SPAN;
+    int windowEnd = at + newLen + TERMINAL_EDITOR_SEARCH_REGEX_SPAN;
+    if (windowEnd > row->size) {
+        windowEnd = row->size;
+    }
+    int oldWindowEnd = windowEnd - delta;
+
+    // The matches that begin before the window stay, unless they reach into 
+    // the edit, and the scan picks up after them.
+    int start = searchIndexLowerBound(search, fileRow, (windowStart > 0)? windowStart + 1 : 0);
+    if (start > 0 && matches[start - 1].row == fileRow && 
+        matches[start - 1].col + matches[start - 1].len > at) {
+        start--;
+    }
+    int from = (windowStart > 0)? windowStart + 1 : 0;
+    if (start > 0 && matches[start - 1].row == fileRow && 
+        matches[start - 1].col + matches[start - 1].len > from) {
+        from = matches[start - 1].col + matches[start - 1].len;
     }
-    editorInsertCharIntoRow(&editor.rows[editor.cursorY], editor.cursorX, ch);
-    editor.cursorX++;
-}
 
-void editorInsertNewline() {
-    // We are at the start of a line, we can just add a new empty line.
-    if (editor.cursorX == 0) {
-        editorInsertRow(editor.cursorY, "", 0);
+    // So do the ones that reach past the window, unless they begin in the 
+    // edit.
+    int rowEnd = searchIndexLowerBound(search, fileRow + 1, 0);
+    int end = rowEnd;
+    if (windowEnd < row->size) {
+        end = searchIndexLowerBound(search, fileRow, oldWindowEnd);
+        if (end > start && matches[end - 1].col + matches[end - 1].len >= oldWindowEnd && 
+            matches[end - 1].col >= at + oldLen) {
+            end--;
+        }
+    }
+    if (end < start) {
+        end = start;
+    }
+    for (int i = end; i < rowEnd; ++i) {
+        matches[i].col += delta;
     }
-    // We are pressing ENTER in the middle of an existing line, therefore 
-    // we must split it along where the cursor's X position is.
-    else {
-        struct TextRow *row = &editor.rows[editor.cursorY];
-        editorInsertRow(editor.cursorY + 1, &row->chars[editor.cursorX], row->size - editor.cursorX);
 
-        // Reassign the row as it might have been invalidated by the call to 
-        // `editorInsertRow`.
-        row = &editor.rows[editor.cursorY];
-        row->size = editor.cursorX;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+    // The character before `from` is kept for whole-word checks. Since only 
+    // the start of the text matches `^`, it can't match there.
+    int textStart = (from > 0)? from - 1 : 0;
+    const char *text = searchRowWindow(row, &textStart, &windowEnd);
+    searchScanRowRegex(pattern, text, windowEnd - textStart, from - textStart, fileRow, 
+        &found, &foundAmt, &foundCapacity);
+
+    // The new matches replace the old ones they overlap, until they line up 
+    // with the old ones again. A match that runs into the end of the window 
+    // could be longer, or only match `$` there, so it is left out.
+    int keptAmt = 0;
+    for (int i = 0; i < foundAmt; ++i) {
+        int col = textStart + found[i].col;
+        int matchEnd = col + found[i].len;
+        if ((end < rowEnd && col >= matches[end].col) || 
+            (matchEnd == windowEnd && windowEnd < row->size)) {
+            break;
+        }
+        found[keptAmt] = found[i];
+        found[keptAmt].col = col;
+        keptAmt++;
+        while (end < rowEnd && matches[end].col < matchEnd) {
+            end++;
+        }
     }
-    editor.cursorY++;
-    editor.cursorX = 0;
+    searchIndexSplice(search, start, end, found, keptAmt);
 }
 
-void editorDelChar() {
-    if (editor.cursorY == editor.rowAmt) {
-        return;
+// Moves the matches of the rows at/after `fileRow` down by `delta` rows.
+void searchIndexShiftRows(struct SearchIndex *search, int fileRow, int delta) {
+    for (int i = searchIndexLowerBound(search, fileRow, 0); i < search->matchAmt; ++i) {
+        search->matches[i].row += delta;
     }
-    if (editor.cursorX == 0 && editor.cursorY == 0) {
+}
+
+// Notes that the row at `fileRow` was edited during a batch: inserted when 
+// `rowDelta` is 1, deleted when it is -1, or changed. The noted rows grow to 
+// cover it, so edits all over the buffer still end up rescanning the rows 
+// in between.
+void searchIndexBatchEdit(struct SearchIndex *search, int fileRow, int rowDelta) {
+    int end = (rowDelta < 0)? fileRow : fileRow + 1;
+    if (!search->batchEdited) {
+        search->batchEdited = true;
+        search->batchStart = fileRow;
+        search->batchEnd = end;
+        search->batchDelta = rowDelta;
         return;
     }
-
-    struct TextRow *row = &editor.rows[editor.cursorY];
-    if (editor.cursorX > 0) {
-        editorDeleteCharFromRow(row, editor.cursorX - 1);
-        editor.cursorX--;
+    if (fileRow < search->batchStart) {
+        search->batchStart = fileRow;
     }
-    else {
-        editor.cursorX = editor.rows[editor.cursorY - 1].size;
-        editorAppendStringToRow(&editor.rows[editor.cursorY - 1], row->chars, row->size);
-        editorDeleteRow(editor.cursorY);
-        editor.cursorY--;
+    if (search->batchEnd + rowDelta > end) {
+        end = search->batchEnd + rowDelta;
     }
+    search->batchEnd = end;
+    search->batchDelta += rowDelta;
 }
 
-/*
- * File IO.
- */
-
-char *editorRowsToString(int *bufLen) {
-    int totalLen = 0;
-    for (int i = 0; i < editor.rowAmt; ++i) {
-        totalLen += editor.rows[i].size + 1; // +1 for line feeds
+// Updates the index for the rows edited during the batch: their matches are 
+// replaced with the ones in their current text, and the matches after them 
+// are moved by the amount of inserted rows, once.
+void searchIndexFinishBatch(struct SearchIndex *search) {
+    static struct SearchMatch *found = NULL;
+    static int foundCapacity = 0;
+    int foundAmt = 0;
+
+    struct RowIter it = editorRowIterAt(search->batchStart);
+    for (int fileRow = search->batchStart; fileRow < search->batchEnd; ++fileRow) {
+        searchScanRow(&search->pattern, editorRowIterNext(&it), fileRow, &found, &foundAmt, &foundCapacity);
     }
-    *bufLen = totalLen; // save out param
-
-    // Use the total character length calculated in the previous 
-    // pass to allocate the entire buffer at once.
-    char *buf = malloc(totalLen);
 
-    // Iterator into the buffer. 
-    // Always points to the start position of a line by the end of a loop 
-    // iteration.
-    char *iter = buf;
-    
-    for (int i = 0; i < editor.rowAmt; i++) {
-        // Copy each row to the buffer.
-        memcpy(iter, editor.rows[i].chars, editor.rows[i].size);
-
-        // Move the iterator past the current line.
-        iter += editor.rows[i].size;
-
-        // Add a line feed to separate the lines in the file string.
-        *iter = '\n';
-        iter++;
+    int start = searchIndexLowerBound(search, search->batchStart, 0);
+    int end = searchIndexLowerBound(search, search->batchEnd - search->batchDelta, 0);
+    searchIndexSplice(search, start, end, found, foundAmt);
+    if (search->batchDelta != 0) {
+        for (int i = start + foundAmt; i < search->matchAmt; ++i) {
+            search->matches[i].row += search->batchDelta;
+        }
     }
-    return buf;
 }
 
-void editorOpen(char *filename) {
-    free(editor.filename);
-    editor.filename = strdup(filename);
-
-    editorSelectSyntaxHighlight();
+// Starts a batch of edits, such as a paste or an undo step, after which the 
+// search index is only updated once. Batches can be nested.
+void editorSearchBeginBatch() {
+    editor.search.batchDepth++;
+}
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        die("fopen");
+void editorSearchEndBatch() {
+    struct SearchIndex *search = &editor.search;
+    search->batchDepth--;
+    if (search->batchDepth > 0 || !search->batchEdited) {
+        return;
     }
-
-    char *line = NULL;
-    size_t lineCapacity = 0;
-    ssize_t lineLen;
-
-    while ((lineLen = getline(&line, &lineCapacity, fp)) != -1) {
-        while (lineLen > 0 
-            && (line[lineLen - 1] == '\n' || line[lineLen - 1] == '\r')
-        ) {
-            lineLen--;
-        }
-        editorInsertRow(editor.rowAmt, line, lineLen);
+    search->batchEdited = false;
+    if (search->active && search->pattern.len > 0) {
+        searchIndexFinishBatch(search);
     }
-    free(line);
-    fclose(fp);
+}
 
-    // When loading the file contents, the file is marked as dirty.
-    // We don't want this, so we mark the file as not dirty at the end of this
-    // process.
-    editor.isDirty = false;
+void editorSearchRowInserted(int fileRow) {
+    if (!editor.search.active || editor.search.pattern.len == 0) {
+        return;
+    }
+    if (editor.search.batchDepth > 0) {
+        searchIndexBatchEdit(&editor.search, fileRow, 1);
+        return;
+    }
+    searchIndexShiftRows(&editor.search, fileRow, 1);
+    searchIndexRescanRow(&editor.search, fileRow);
 }
 
-void editorSave() {
-    if (editor.filename == NULL) {
-        editor.filename = editorPrompt("Save as: %s", NULL);
+void editorSearchRowDeleted(int fileRow) {
+    if (!editor.search.active || editor.search.pattern.len == 0) {
+        return;
+    }
+    if (editor.search.batchDepth > 0) {
+        searchIndexBatchEdit(&editor.search, fileRow, -1);
+        return;
+    }
+    int start = searchIndexLowerBound(&editor.search, fileRow, 0);
+    int end = searchIndexLowerBound(&editor.search, fileRow + 1, 0);
+    searchIndexSplice(&editor.search, start, end, NULL, 0);
+    searchIndexShiftRows(&editor.search, fileRow + 1, -1);
+}
 
-        if (editor.filename == NULL) {
-            editorSetStatusMessage("Save aborted.");
-            return;
-        }
-        editorSelectSyntaxHighlight();
+// Updates the matches of the row after `delta` characters were inserted at 
+// `at`, or removed from there when negative. Long rows are only rescanned 
+// around the edit.
+void editorSearchRowChanged(int fileRow, int at, int delta) {
+    if (!editor.search.active || editor.search.pattern.len == 0) {
+        return;
+    }
+    if (editor.search.batchDepth > 0) {
+        searchIndexBatchEdit(&editor.search, fileRow, 0);
+        return;
+    }
+    if (editorRowAt(fileRow)->longRow == NULL) {
+        searchIndexRescanRow(&editor.search, fileRow);
+        return;
     }
 
-    int len;
-    char *buf = editorRowsToString(&len);
-
-    int fd = open(editor.filename, O_RDWR | O_CREAT, 0644);
-    
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                // Mark the file as no longer dirty as we are saving it.
-                editor.isDirty = false;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }    
-        }
-        close(fd);
+    int oldLen = (delta < 0)? -delta : 0;
+    int newLen = (delta > 0)? delta : 0;
+    if (editor.search.pattern.flags & SEARCH_REGEX) {
+        searchIndexEditRegex(&editor.search, fileRow, at, oldLen, newLen);
+    }
+    else {
+        searchIndexEditLiteral(&editor.search, fileRow, at, oldLen, newLen);
     }
-    free(buf);
-    editorSetStatusMessage("Cannot save file: %s", strerror(errno));
 }
 
 /*
  * Finding / text-search.
  */
 
+#define TERMINAL_EDITOR_FIND_PROMPT "Search: %s (ESC/Arrows/Enter)"
 
-void editorFindCallback(char *query, int key) {
-    static int lastMatch = -1;
-    static int direction = 1;
+// Moves the cursor to the selected match of the search, if there is one.
+void editorJumpToMatch() {
+    struct SearchIndex *search = &editor.search;
+    if (search->current == -1) {
+        return;
+    }
+    struct SearchMatch *match = &search->matches[search->current];
+
+    editor.cursorY = match->row;
+    editor.cursorX = match->col;
+    editor.rowOffset = editor.rowAmt;
+}
 
-    static int savedHighlightLine;
-    static char *savedHighlight = NULL;
+// Shows that a search is still scanning the buffer, along with its first 
+// match once it is found.
+void editorSearchProgress(const struct SearchMatch *match) {
+    if (match != NULL) {
+        editor.cursorY = match->row;
+        editor.cursorX = match->col;
+        editor.rowOffset = editor.rowAmt;
+    }
+
+    editorSetStatusMessage(TERMINAL_EDITOR_FIND_PROMPT " searching...", editor.search.query);
+    editorRefreshScreen();
+}
 
-    if (savedHighlight) {
-        memcpy(editor.rows[savedHighlightLine].highlight, savedHighlight, editor.rows[savedHighlightLine].renderSize);
-        free(savedHighlight);
-        savedHighlight = NULL;
+// Writes which match of the search is selected into `buf`.
+void editorDescribeMatch(char *buf, size_t size) {
+    struct SearchIndex *search = &editor.search;
+    if (search->current == -1) {
+        snprintf(buf, size, "no matches");
+    }
+    else {
+        snprintf(buf, size, "match %d of %d", search->current + 1, search->matchAmt);
     }
+}
 
-    if (key == '\r' || key == '\x1b') {
-        lastMatch = -1;
-        direction = 1;
+void editorFindCallback(char *query, int key) {
+    static int flags = 0;
+
+    struct SearchIndex *search = &editor.search;
+    search->highlightCurrent = false;
+
+    // The matches are kept after the search is confirmed, to be stepped 
+    // through with CTRL-N and CTRL-P. A scan that was cut short by typing 
+    // is finished first.
+    if (key == '\r') {
+        editor.promptInfo[0] = '\0';
+        if (!search->active && searchIndexSetQuery(search, query, flags)) {
+            editorJumpToMatch();
+        }
         return;
     }
+    else if (key == '\x1b') {
+        editor.promptInfo[0] = '\0';
+        searchIndexClear(search);
+        return;
+    }
+    else if (!search->active && (key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP)) {
+        searchIndexSetQuery(search, query, flags);
+    }
     else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
+        searchIndexStep(search, 1);
     }
     else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
+        searchIndexStep(search, -1);
     }
     else {
-        lastMatch = -1;
-        direction = 1;
-    }
-
-    if (lastMatch == -1) {
-        direction = 1;
-    }
-    int current = lastMatch;
-
-    // Loop through all the rows to see if we get a match for the 
-    // user's search string.
-    // If we do get a match, we move the cursor to the first row that 
-    // matches.
-    for (int i = 0; i < editor.rowAmt; ++i) {
-        current += direction;
-        if (current == -1) {
-            current = editor.rowAmt - 1;
+        if (key == CTRL_KEY('c')) {
+            flags ^= SEARCH_IGNORE_CASE;
         }
-        else if (current == editor.rowAmt) {
-            current = 0;
+        else if (key == CTRL_KEY('w')) {
+            flags ^= SEARCH_WHOLE_WORD;
         }
+        else if (key == CTRL_KEY('r')) {
+            flags ^= SEARCH_REGEX;
+        }
+        searchIndexSetQuery(search, query, flags);
+    }
 
-        struct TextRow *row = &editor.rows[current];
-        char *match = strstr(row->render, query);
-
-        if (match) {
-            lastMatch = current;
-            editor.cursorY = current;
-            
-            // The difference between the match and render pointers is an index into the 
-            // render array, not the chars array. Since `editor.cursorX` is supposed to be 
-            // an index into the chars array, we need to convert it.
-            editor.cursorX = editorRenderCursorXToReal(row, match - row->render);
-            editor.rowOffset = editor.rowAmt;
-
-            // Save the line with the match before applying the highlight to 
-            // be able to restore it later.
-            savedHighlightLine = current;
-            savedHighlight = malloc(row->renderSize);
-            memcpy(savedHighlight, row->highlight, row->renderSize);
-
-            // Highlight matches.
-            memset(&row->highlight[match - row->render], HL_MATCH, strlen(query));
+    editorJumpToMatch();
 
-            break;
-        }
+    // Show the search modes in front of the match count.
+    char count[32];
+    if (search->pattern.error != NULL) {
+        snprintf(count, sizeof(count), "bad regex: %s", search->pattern.error);
+    }
+    else if (!search->active) {
+        snprintf(count, sizeof(count), "searching...");
+    }
+    else {
+        editorDescribeMatch(count, sizeof(count));
     }
+    snprintf(editor.promptInfo, sizeof(editor.promptInfo), "%s%s%s%s",
+        (flags & SEARCH_REGEX)? "[regex] " : "",
+        (flags & SEARCH_IGNORE_CASE)? "[any case] " : "",
+        (flags & SEARCH_WHOLE_WORD)? "[word] " : "",
+        count);
+
+    // The selected match is highlighted as the screen is drawn.
+    search->highlightCurrent = (search->current != -1);
 } 
 
 void editorFind() {
@@ -1016,8 +6348,13 @@ void editorFind() {
     int savedCursorY = editor.cursorY;
     int savedColOffset = editor.colOffset;
     int savedRowOffset = editor.rowOffset;
+
+    // Start a new search from the cursor.
+    searchIndexClear(&editor.search);
+    editor.search.originRow = editor.cursorY;
+    editor.search.originCol = editor.cursorX;
     
-    char *query = editorPrompt("Search %s (Use ESC/Arrow Keys/Enter)", editorFindCallback);
+    char *query = editorPrompt(TERMINAL_EDITOR_FIND_PROMPT, editorFindCallback);
     
     // The user found what they where looking for, therefore we free the query.
     if (query) {
@@ -1033,6 +6370,87 @@ void editorFind() {
     }
 }
 
+// Moves to the next match of the last search, or the previous one when 
+// `direction` is -1.
+void editorFindNext(int direction) {
+    if (!editor.search.active) {
+        editorSetStatusMessage("No search to repeat, press CTRL-F to find");
+        return;
+    }
+    searchIndexStep(&editor.search, direction);
+    editorJumpToMatch();
+
+    char count[32];
+    editorDescribeMatch(count, sizeof(count));
+    editorSetStatusMessage("%s: %s", editor.search.query, count);
+}
+
+/*
+ * Going to a line or byte offset.
+ */
+
+// Asks for a non-negative decimal number with `prompt`. When `allowHex` is 
+// set, it can also be given in hexadecimal with a "0x" prefix. Returns false 
+// if the prompt was canceled or the answer is not a number.
+bool editorPromptNumber(char *prompt, bool allowHex, long long *number) {
+    char *input = editorPrompt(prompt, NULL);
+    if (input == NULL) {
+        return false;
+    }
+    // Only digits are accepted after the prefix: strtoll would also take a 
+    // sign, or another "0x" in base 16.
+    bool hex = allowHex && input[0] == '0' && (input[1] == 'x' || input[1] == 'X');
+    char *digits = hex? &input[2] : input;
+    const char *digitChars = hex? "0123456789abcdefABCDEF" : "0123456789";
+    errno = 0;
+    *number = strtoll(digits, NULL, hex? 16 : 10);
+    bool valid = digits[0] != '\0' && digits[strspn(digits, digitChars)] == '\0' && errno == 0;
+    if (!valid) {
+        editorSetStatusMessage("Not a number: %s", input);
+    }
+    free(input);
+    return valid;
+}
+
+// Moves the cursor to the start of a line, counting from 1, and scrolls it 
+// to the top of the screen.
+void editorGotoLine() {
+    long long line;
+    if (!editorPromptNumber("Go to line: %s (ESC to cancel)", false, &line)) {
+        return;
+    }
+    if (editor.load.active && line > editor.rowAmt) {
+        editorFinishLoading();
+    }
+    if (line > editor.rowAmt) {
+        line = editor.rowAmt;
+    }
+    editorMoveCursorTo(0, (line > 0)? line - 1 : 0);
+    editor.rowOffset = editor.rowAmt;
+}
+
+// Moves the cursor to the byte at an offset of the file as it would be 
+// saved, and scrolls it to the top of the screen.
+void editorGotoByte() {
+    long long offset;
+    if (!editorPromptNumber("Go to byte offset: %s (ESC to cancel)", true, &offset)) {
+        return;
+    }
+    if (editor.load.active && offset >= editorRowByteOffset(editor.rowAmt)) {
+        editorFinishLoading();
+    }
+    // An offset past the end of the file goes to the end of the file.
+    int fileRow = editorRowAtByte(offset);
+    struct TextRow *row = editorRowAt(fileRow);
+    long long col = offset - editorRowByteOffset(fileRow);
+    long long rowLen = (row != NULL)? row->size : 0;
+    if (col < 0) {
+        col = 0;
+    }
+    editorMoveCursorTo((col < rowLen)? col : rowLen, fileRow);
+    editor.rowOffset = editor.rowAmt;
+}
+
 /*
  * Input handling.
  */
@@ -1045,8 +6463,13 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
     size_t bufLen = 0;
     buf[0] = '\0';
 
+    editor.prompting = true;
     while (true) {
         editorSetStatusMessage(prompt, buf);
+        if (editor.promptInfo[0] != '\0') {
+            size_t msgLen = strlen(editor.statusMsg);
+            snprintf(&editor.statusMsg[msgLen], sizeof(editor.statusMsg) - msgLen, " %s", editor.promptInfo);
+        }
         editorRefreshScreen();
 
         int ch = editorReadKey();
@@ -1058,6 +6481,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
             }
         }
         else if (ch == '\x1b') {
+            editor.prompting = false;
             editorSetStatusMessage("");
 
             if (callback) {
@@ -1069,6 +6493,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
         }
         else if (ch == '\r') {
             if (bufLen != 0) {
+                editor.prompting = false;
                 editorSetStatusMessage("");
 
                 if (callback) {
@@ -1078,14 +6503,31 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
                 return buf;
             }
         }
-        else if (!iscntrl(ch) && ch < 128) {
-            if (bufLen == bufSize - 1) {
-                bufSize *= 2;
-                buf = realloc(buf, bufSize);
+        else if (ch == PASTE_START || (!iscntrl(ch) && ch < 128)) {
+            // Pasted text is added up to its first line break.
+            struct AppendBuf text = NEW_APPEND_BUF;
+            if (ch == PASTE_START) {
+                editorReadPaste(&text);
+                text.len = textFindLineBreak(text.buf, 0, text.len);
+            }
+            else {
+                char c = ch;
+                bufAppend(&text, &c, 1);
+            }
+
+            for (size_t i = 0; i < text.len; ++i) {
+                if (iscntrl(text.buf[i])) {
+                    continue;
+                }
+                if (bufLen == bufSize - 1) {
+                    bufSize *= 2;
+                    buf = realloc(buf, bufSize);
+                }
+                buf[bufLen] = text.buf[i];
+                bufLen++;
+                buf[bufLen] = '\0';
             }
-            buf[bufLen] = ch;
-            bufLen++;
-            buf[bufLen] = '\0';
+            freeAppendBuf(&text);
         }
 
         if (callback) {
@@ -1095,7 +6537,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 }
 
 void editorMoveCursor(int key) {
-    struct TextRow *currRow = (editor.cursorY >= editor.rowAmt)? NULL : &editor.rows[editor.cursorY];
+    struct TextRow *currRow = editorRowAt(editor.cursorY);
 
     switch (key) {
         case ARROW_LEFT:
@@ -1103,7 +6545,7 @@ void editorMoveCursor(int key) {
                 // Move to the end of the previous line (if it exists).
                 if (editor.cursorY > 0) {
                     editor.cursorY--;
-                    editor.cursorX = editor.rows[editor.cursorY].size;
+                    editor.cursorX = editorRowAt(editor.cursorY)->size;
                 }
 
                 break;
@@ -1139,18 +6581,65 @@ void editorMoveCursor(int key) {
 
     // Snap the cursor's x position to the length of the current row if it 
     // goes past it.
-    currRow = (editor.cursorY >= editor.rowAmt)? NULL : &editor.rows[editor.cursorY];
+    currRow = editorRowAt(editor.cursorY);
     int rowLen = (currRow != NULL)? currRow->size : 0;
     if (editor.cursorX > rowLen) {
         editor.cursorX = rowLen;
     } 
 }
 
+// Sleeps until there is input from the terminal, running timers, finishing 
+// background saves and following resizes of the terminal in the meantime. 
+// Returns whether there is input to read, or false as soon as something 
+// happened that needs the screen to be redrawn.
+bool editorWaitForInput() {
+    while (editor.input.start == editor.input.len) {
+        struct pollfd pfds[3] = {
+            { STDIN_FILENO, POLLIN, 0 },
+            { editor.resizeFds[0], POLLIN, 0 },
+            { editor.save.active? editor.save.wakeFds[0] : -1, POLLIN, 0 },
+        };
+        int ready = poll(pfds, 3, timersNextTimeout());
+        if (ready == -1) {
+            if (errno != EINTR) {
+                die("poll");
+            }
+            continue;
+        }
+
+        bool redraw = timersRun();
+        if (pfds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(editor.resizeFds[0], drain, sizeof(drain)) > 0) {}
+            editorHandleResize();
+            redraw = true;
+        }
+        if (pfds[2].revents & POLLIN) {
+            editorFinishSave();
+            redraw = true;
+        }
+        if (redraw) {
+            return false;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            return true;
+        }
+        // Without a terminal to read from, there is nothing left to wait for.
+        if (pfds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            errno = EIO;
+            die("poll");
+        }
+    }
+    return true;
+}
+
 // Waits for a key press and processes it. 
 void editorProcessKeypress() {
     static int quitTimes = TERMINAL_EDITOR_QUIT_TIMES;
 
     int ch = editorReadKey();
+    undoStartKey(&editor.undo, ch);
 
     switch (ch) {
         case '\r':
@@ -1158,15 +6647,21 @@ void editorProcessKeypress() {
             break;
 
         case CTRL_KEY('q'):
+            // Let a save that is still running finish writing the file.
+            editorFinishSave();
+
             // Stop the user from quitting immediately if they have 
             // unsaved changes.
-            if (editor.isDirty && quitTimes > 0) {
+            if (editorIsDirty() && quitTimes > 0) {
                 editorSetStatusMessage("Warning: Unsaved changes! " 
                     "Press CTRL-Q %d more times to quit.", quitTimes);
                 quitTimes--;
                 return;
             }
 
+            // The unsaved edits are being thrown away.
+            journalRemove(&editor.journal);
+
             clearTermScreen();
             resetTermCursor();
             exit(0);
@@ -1182,7 +6677,7 @@ void editorProcessKeypress() {
 
         case END_KEY:
             if (editor.cursorY < editor.rowAmt) {
-                editor.cursorX = editor.rows[editor.cursorY].size;
+                editor.cursorX = editorRowAt(editor.cursorY)->size;
             }
             break;
 
@@ -1190,6 +6685,38 @@ void editorProcessKeypress() {
             editorFind();
             break;
 
+        case CTRL_KEY('n'):
+            editorFindNext(1);
+            break;
+
+        case CTRL_KEY('p'):
+            editorFindNext(-1);
+            break;
+
+        case CTRL_KEY('t'):
+            editorShowFrameStats();
+            break;
+
+        case CTRL_KEY('z'):
+            editorUndo(false);
+            break;
+
+        case PASTE_START:
+        {
+            struct AppendBuf text = NEW_APPEND_BUF;
+            editorReadPaste(&text);
+            editorInsertText(text.buf, text.len);
+            freeAppendBuf(&text);
+            break;
+        }
+
+        case PASTE_END:
+            break;
+
+        case CTRL_KEY('y'):
+            editorUndo(true);
+            break;
+
         case BACKSPACE:
         case CTRL_KEY('h'):
         case DEL_KEY:
@@ -1203,19 +6730,16 @@ void editorProcessKeypress() {
         case PAGE_UP:
         case PAGE_DOWN:
         {
+            // Move the cursor to the edge of the screen, then a screen 
+            // further, in a single jump.
+            int cursorY;
             if (ch == PAGE_UP) {
-                editor.cursorY = editor.rowOffset;
-            }
-            else if (ch == PAGE_DOWN) {
-                editor.cursorY = editor.rowOffset + editor.termRows - 1;
-
-                if (editor.cursorY > editor.rowAmt) {
-                    editor.cursorY = editor.rowAmt;
-                }
+                cursorY = editor.rowOffset - editor.termRows;
             }
-            for (int _i = 0; _i < editor.rowAmt; ++_i) {
-                editorMoveCursor((ch == PAGE_UP)? ARROW_UP : ARROW_DOWN);
+            else {
+                cursorY = editor.rowOffset + 2 * editor.termRows - 1;
             }
+            editorMoveCursorTo(editor.cursorX, (cursorY > 0)? cursorY : 0);
             break;
         }
 
@@ -1226,7 +6750,20 @@ void editorProcessKeypress() {
             editorMoveCursor(ch);
             break;
 
+        case CTRL_KEY('g'):
+            editorGotoLine();
+            break;
+
+        case CTRL_KEY('b'):
+            editorGotoByte();
+            break;
+
         case CTRL_KEY('l'):
+            // Repaint the whole screen on the next refresh, in case the 
+            // terminal no longer matches the last frame written to it.
+            editor.screen.shadowValid = false;
+            break;
+
         case '\x1b':
             // Ignore control characters.
             break;
@@ -1237,6 +6774,261 @@ void editorProcessKeypress() {
     }
 
     quitTimes = TERMINAL_EDITOR_QUIT_TIMES;
+    undoEndKey(&editor.undo);
+}
+
+/*
+ * Screen buffer.
+ *
+ * Frames are first drawn into a grid of cells (a character plus its 
+ * attributes for each screen position). The last frame written to the 
+ * terminal is kept around as a shadow copy, and only the spans of lines 
+ * that differ from it are written out.
+ */
+
+void screenFreeLines(struct ScreenLine *lines, int rows) {
+    if (lines == NULL) {
+        return;
+    }
+    for (int y = 0; y < rows; ++y) {
+        free(lines[y].chars);
+        free(lines[y].attrs);
+    }
+    free(lines);
+}
+
+struct ScreenLine *screenNewLines(int rows, int cols) {
+    struct ScreenLine *lines = calloc(rows, sizeof(struct ScreenLine));
+    if (lines == NULL) {
+        die("calloc");
+    }
+    for (int y = 0; y < rows; ++y) {
+        lines[y].chars = malloc(cols);
+        lines[y].attrs = malloc(cols);
+        if (lines[y].chars == NULL || lines[y].attrs == NULL) {
+            die("malloc");
+        }
+    }
+    return lines;
+}
+
+// Sizes the screen to `rows` by `cols` cells. The next frame is written out 
+// in full.
+void screenResize(struct Screen *screen, int rows, int cols) {
+    screenFreeLines(screen->lines, screen->rows);
+    screenFreeLines(screen->shadow, screen->rows);
+
+    screen->rows = rows;
+    screen->cols = cols;
+    screen->lines = screenNewLines(rows, cols);
+    screen->shadow = screenNewLines(rows, cols);
+    screen->shadowValid = false;
+}
+
+// Moves the lines from `top` up to (not including) `bottom` up by `amount` 
+// lines, or down when `amount` is negative. Lines shifted out of the region 
+// come back in blank on the other side.
+void screenShiftLines(struct ScreenLine *lines, int top, int bottom, int amount) {
+    int height = bottom - top;
+    int rotate = (amount > 0)? amount : height + amount;
+
+    // Rotate the region left by `rotate` lines with three reversals.
+    int bounds[3][2] = { {top, top + rotate}, {top + rotate, bottom}, {top, bottom} };
+    for (int i = 0; i < 3; ++i) {
+        for (int a = bounds[i][0], b = bounds[i][1] - 1; a < b; ++a, --b) {
+            struct ScreenLine tmp = lines[a];
+            lines[a] = lines[b];
+            lines[b] = tmp;
+        }
+    }
+
+    int blankStart = (amount > 0)? bottom - amount : top;
+    for (int y = blankStart; y < blankStart + abs(amount); ++y) {
+        lines[y].len = 0;
+    }
+}
+
+// Records that the lines from `top` up to (not including) `bottom` scrolled 
+// up by `amount` lines (down when negative) since the last frame. The next 
+// flush has the terminal scroll them instead of redrawing them.
+void screenScroll(struct Screen *screen, int top, int bottom, int amount) {
+    if (amount == 0 || abs(amount) >= bottom - top) {
+        return;
+    }
+    screen->scrollTop = top;
+    screen->scrollBottom = bottom;
+    screen->scrollAmount = amount;
+}
+
+// Appends `len` characters of `s` to the line, all with the attribute `attr`.
+// Characters past the width of the screen are dropped.
+void screenLineAppend(struct Screen *screen, struct ScreenLine *line, const char *s, int len, unsigned char attr) {
+    if (len > screen->cols - line->len) {
+        len = screen->cols - line->len;
+    }
+    if (len <= 0) {
+        return;
+    }
+    memcpy(&line->chars[line->len], s, len);
+    memset(&line->attrs[line->len], attr, len);
+    line->len += len;
+}
+
+// Compares the cell at column `x` of two lines, cells past the end of a line 
+// being blank.
+bool screenCellsEqual(struct ScreenLine *a, struct ScreenLine *b, int x) {
+    char aChar = (x < a->len) ? a->chars[x] : ' ';
+    char bChar = (x < b->len) ? b->chars[x] : ' ';
+    unsigned char aAttr = (x < a->len) ? a->attrs[x] : HL_NORMAL;
+    unsigned char bAttr = (x < b->len) ? b->attrs[x] : HL_NORMAL;
+    return aChar == bChar && aAttr == bAttr;
+}
+
+// Fills in the escape sequence that switches to each cell attribute.
+void screenInitSgrTable(struct Screen *screen) {
+    for (int attr = 0; attr < 256; ++attr) {
+        int highlight = attr & ~CELL_INVERSE;
+        int color = (highlight == HL_NORMAL) ? 39 : editorSyntaxToColor(highlight);
+
+        struct SgrCode *sgr = &screen->sgrTable[attr];
+        sgr->len = snprintf(sgr->seq, sizeof(sgr->seq), "\x1b[%d;%dm", (attr & CELL_INVERSE) ? 7 : 27, color);
+    }
+}
+
+void screenAppendAttr(struct Screen *screen, struct AppendBuf *aBuf, unsigned char attr) {
+    bufAppend(aBuf, screen->sgrTable[attr].seq, screen->sgrTable[attr].len);
+}
+
+void screenAppendMoveCursor(struct AppendBuf *aBuf, int row, int col) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row + 1, col + 1);
+    bufAppend(aBuf, buf, len);
+}
+
+// Appends to `aBuf` what is needed to turn the last frame written to the 
+// terminal into the one that was just drawn, and leaves the cursor at 
+// `cursorRow`, `cursorCol`. Nothing is appended when neither changed.
+void screenFlush(struct Screen *screen, struct AppendBuf *aBuf, int cursorRow, int cursorCol) {
+    size_t frameStart = aBuf->len;
+    if (screen->syncOutput) {
+        bufAppend(aBuf, "\x1b[?2026h", 8);
+    }
+    size_t startLen = aBuf->len;
+    unsigned char currAttr = HL_NORMAL;
+
+    if (!screen->shadowValid) {
+        hideCursor(aBuf);
+        bufAppend(aBuf, "\x1b[m", 3);
+        bufAppend(aBuf, "\x1b[2J", 4);
+        for (int y = 0; y < screen->rows; ++y) {
+            screen->shadow[y].len = 0;
+        }
+        screen->shadowValid = true;
+    }
+    // Let the terminal move the lines of a scrolled region, leaving only the 
+    // exposed lines to be drawn.
+    else if (screen->scrollAmount != 0) {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r", 
+            screen->scrollTop + 1, screen->scrollBottom, 
+            abs(screen->scrollAmount), (screen->scrollAmount > 0)? 'S' : 'T');
+
+        hideCursor(aBuf);
+        bufAppend(aBuf, buf, len);
+        screenShiftLines(screen->shadow, screen->scrollTop, screen->scrollBottom, screen->scrollAmount);
+
+        // Resetting the scroll region moves the cursor to the top-left.
+        screen->cursorRow = 0;
+        screen->cursorCol = 0;
+    }
+    screen->scrollAmount = 0;
+
+    for (int y = 0; y < screen->rows; ++y) {
+        struct ScreenLine *line = &screen->lines[y];
+        struct ScreenLine *old = &screen->shadow[y];
+        int width = (line->len > old->len) ? line->len : old->len;
+
+        int x = 0;
+        while (x < width) {
+            if (screenCellsEqual(line, old, x)) {
+                x++;
+                continue;
+            }
+
+            // Find the end of the changed span, merging in the changed spans 
+            // that follow it closely.
+            int spanEnd = x + 1;
+            int gap = 0;
+            for (int i = spanEnd; i < width && gap < TERMINAL_EDITOR_DAMAGE_GAP; ++i) {
+                if (screenCellsEqual(line, old, i)) {
+                    gap++;
+                }
+                else {
+                    spanEnd = i + 1;
+                    gap = 0;
+                }
+            }
+
+            if (aBuf->len == startLen) {
+                hideCursor(aBuf);
+            }
+            screenAppendMoveCursor(aBuf, y, x);
+
+            // Write the span as runs of cells with the same attribute, each 
+            // with a single copy.
+            int drawEnd = (spanEnd < line->len) ? spanEnd : line->len;
+            while (x < drawEnd) {
+                int runEnd = x + 1;
+                while (runEnd < drawEnd && line->attrs[runEnd] == line->attrs[x]) {
+                    runEnd++;
+                }
+                if (line->attrs[x] != currAttr) {
+                    currAttr = line->attrs[x];
+                    screenAppendAttr(screen, aBuf, currAttr);
+                }
+                bufAppend(aBuf, &line->chars[x], runEnd - x);
+                x = runEnd;
+            }
+
+            // The rest of the span is past the end of the new line, which is 
+            // blank, so clear the line from here on.
+            if (spanEnd > line->len) {
+                if (currAttr != HL_NORMAL) {
+                    currAttr = HL_NORMAL;
+                    screenAppendAttr(screen, aBuf, currAttr);
+                }
+                clearTermLine(aBuf);
+                break;
+            }
+            x = spanEnd;
+        }
+    }
+
+    if (currAttr != HL_NORMAL) {
+        screenAppendAttr(screen, aBuf, HL_NORMAL);
+    }
+
+    bool damaged = aBuf->len != startLen;
+    if (damaged || cursorRow != screen->cursorRow || cursorCol != screen->cursorCol) {
+        screenAppendMoveCursor(aBuf, cursorRow, cursorCol);
+        screen->cursorRow = cursorRow;
+        screen->cursorCol = cursorCol;
+    }
+    if (damaged) {
+        showCursor(aBuf);
+    }
+
+    if (aBuf->len == startLen) {
+        aBuf->len = frameStart;
+    }
+    else if (screen->syncOutput) {
+        bufAppend(aBuf, "\x1b[?2026l", 8);
+    }
+
+    // The frame that was just drawn is now what is on the terminal.
+    struct ScreenLine *lines = screen->lines;
+    screen->lines = screen->shadow;
+    screen->shadow = lines;
 }
 
 /*
@@ -1246,7 +7038,7 @@ void editorProcessKeypress() {
 void editorScroll() {
     editor.renderCursorX = 0;
     if (editor.cursorY < editor.rowAmt) {
-        editor.renderCursorX = editorCursorXRealToRender(&editor.rows[editor.cursorY], editor.cursorX);
+        editor.renderCursorX = editorCursorXRealToRender(editorRowAt(editor.cursorY), editor.cursorX);
     }
 
     if (editor.cursorY < editor.rowOffset) {
@@ -1264,10 +7056,50 @@ void editorScroll() {
     }
 }
 
-void editorDrawRows(struct AppendBuf *aBuf) {
+// Draws the part of a long row that is on screen into `line`, rendering and 
+// highlighting just that part of it.
+void editorDrawLongRow(struct ScreenLine *line, struct TextRow *row) {
+    struct LongRow *longRow = row->longRow;
+    int start = editorRenderCursorXToReal(row, editor.colOffset);
+    longRowValidate(row, start);
+
+    // Highlight from the last checkpoint before the first character on screen.
+    struct HighlightState state;
+    int index = longRowFindCheckpoint(longRow, start, longRow->validAmt);
+    int at = longRowStateBefore(longRow, index, &state);
+    if (state.inLineComment) {
+        // Everything from there on is part of the comment.
+        at = start;
+    }
+    const char *text;
+    unsigned char *hl;
+    longRowHighlight(row, at, start + editor.termCols, &text, &hl, &state);
+
+    int renderX = editorCursorXRealToRender(row, start);
+    for (int i = start; i < row->size && line->len < editor.termCols; ++i) {
+        char c = text[i - at];
+        int width = 1;
+        if (c == '\t') {
+            c = ' ';
+            width = TERMINAL_EDITOR_TAB_SIZE - renderX % TERMINAL_EDITOR_TAB_SIZE;
+        }
+        for (; width > 0 && line->len < editor.termCols; --width, ++renderX) {
+            if (renderX >= editor.colOffset) {
+                line->chars[line->len] = c;
+                line->attrs[line->len] = hl[i - at];
+                line->len++;
+            }
+        }
+    }
+}
+
+void editorDrawRows(struct Screen *screen) {
     for (int y = 0; y < editor.termRows; y++) {
+        struct ScreenLine *line = &screen->lines[y];
         int fileRow = y + editor.rowOffset;
 
+        line->len = 0;
+
         // Draw a line without text.
         if (fileRow >= editor.rowAmt) {
             if (editor.rowAmt == 0 && y == editor.termRows / 3) {
@@ -1280,157 +7112,202 @@ void editorDrawRows(struct AppendBuf *aBuf) {
                 }
                 int padding = (editor.termCols - welcomeLen) / 2;
                 if (padding > 0) {
-                    bufAppend(aBuf, "~", 1);
+                    screenLineAppend(screen, line, "~", 1, HL_NORMAL);
                     padding--;
                 }
                 while (padding > 0) {
                     padding--;
-                    bufAppend(aBuf, " ", 1);
+                    screenLineAppend(screen, line, " ", 1, HL_NORMAL);
                 }
 
-                bufAppend(aBuf, welcome, welcomeLen);
+                screenLineAppend(screen, line, welcome, welcomeLen, HL_NORMAL);
             }
             else {
-                bufAppend(aBuf, "~", 1);
+                screenLineAppend(screen, line, "~", 1, HL_NORMAL);
             }
         }
         // Draw a line with text.
         else {
-            int len = editor.rows[fileRow].renderSize - editor.colOffset;
-            if (len < 0) {
-                len = 0;
-            }
-            if (len > editor.termCols) {
-                len = editor.termCols;
-            }
-
-            char *c = &editor.rows[fileRow].render[editor.colOffset];
-            unsigned char *hl = &editor.rows[fileRow].highlight[editor.colOffset];
-            int currColor = -1;
-
-            for (int i = 0; i < len; ++i) {
-                // Handle printing control characters.
-                // They are printed using a '?' with inverted colors.
-                if (iscntrl(c[i])) {
-                    char sym = '?';
-                    bufAppend(aBuf, "\x1b[7m", 4);
-                    bufAppend(aBuf, &sym, 1);
-                    bufAppend(aBuf, "\x1b[m", 3);
-
-                    if (currColor != -1) {
-                        char buf[16];
-                        int cLen = snprintf(buf, sizeof(buf), "\x1b[%dm", currColor);
-                        bufAppend(aBuf, buf, cLen);
-                    }
+            struct TextRow *row = editorRowRendered(fileRow);
+
+            if (row->longRow != NULL) {
+                editorDrawLongRow(line, row);
+            }
+            else {
+                int len = row->renderSize - editor.colOffset;
+                if (len < 0) {
+                    len = 0;
                 }
-                // If the highlight corrresponding to this character is 
-                // `HL_NORMAL` then append a formatting-reset code before 
-                // the character.
-                else if (hl[i] == HL_NORMAL) {
-                   if (currColor != -1) {
-                        bufAppend(aBuf, "\x1b[39m", 5);
-                        currColor = -1;
-                    }
-                    bufAppend(aBuf, &c[i], 1); 
+                if (len > editor.termCols) {
+                    len = editor.termCols;
                 }
-                // Otherwise, append a color code before the character.
-                else {
-                    int color = editorSyntaxToColor(hl[i]);
+                memcpy(line->chars, &editorRowRenderChars(row)[editor.colOffset], len);
+                highlightSpansDecode(row->highlight, editor.colOffset, len, line->attrs);
+                line->len = len;
+            }
 
-                    if (color != currColor) {
-                        currColor = color;
-                        char buf[16];
-                        int cLen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        bufAppend(aBuf, buf, cLen);
-                    }
-                    bufAppend(aBuf, &c[i], 1);
+            // Highlight the selected match while searching. The match was 
+            // found in the chars array, so its bounds need to be converted 
+            // to indices into the render array.
+            struct SearchIndex *search = &editor.search;
+            if (search->highlightCurrent && search->current != -1 && search->matches[search->current].row == fileRow) {
+                struct SearchMatch *match = &search->matches[search->current];
+                int start = editorCursorXRealToRender(row, match->col) - editor.colOffset;
+                int end = editorCursorXRealToRender(row, match->col + match->len) - editor.colOffset;
+                if (start < 0) {
+                    start = 0;
+                }
+                if (end > line->len) {
+                    end = line->len;
+                }
+                if (start < end) {
+                    memset(&line->attrs[start], HL_MATCH, end - start);
                 }
             }
-            // Append another formatting-reset code after appending 
-            // all the row characters just in case.
-            bufAppend(aBuf, "\x1b[39m", 5);
-        }
 
-        clearTermLine(aBuf);
-
-        bufAppend(aBuf, "\r\n", 2);
+            // Control characters are printed using a '?' with inverted colors.
+            for (int i = 0; i < line->len; ++i) {
+                if (iscntrl(line->chars[i])) {
+                    line->chars[i] = '?';
+                    line->attrs[i] = HL_NORMAL | CELL_INVERSE;
+                }
+            }
+        }
     }
 }
 
-void editorDrawStatusBar(struct AppendBuf *aBuf) {
-    // Invert terminal colors for this row.
-    bufAppend(aBuf, "\x1b[7m", 4);
+void editorDrawStatusBar(struct Screen *screen) {
+    struct ScreenLine *line = &screen->lines[editor.termRows];
+    line->len = 0;
 
     // Reserve the left and right portions of the status bar.
     char statusLeft[80], statusRight[80];
 
-    int statusLeftLen = snprintf(statusLeft, sizeof(statusLeft), "%.20s - %d lines %s",
+    char loadStatus[32] = "";
+    if (editor.load.active) {
+        if (editor.load.size > 0) {
+            snprintf(loadStatus, sizeof(loadStatus), " (loading %d%%)", 
+                (int)(editor.load.offset * 100 / editor.load.size));
+        }
+        else {
+            snprintf(loadStatus, sizeof(loadStatus), " (loading)");
+        }
+    }
+
+    int statusLeftLen = snprintf(statusLeft, sizeof(statusLeft), "%.20s - %d lines%s %s%s",
         (editor.filename != NULL)? editor.filename : "[No Filename]", 
         editor.rowAmt,
-        (editor.isDirty)? "(modified)" : "");
+        loadStatus,
+        (editorIsDirty())? "(modified)" : "",
+        (editor.save.active)? " (saving)" : "");
 
-    int statusRightLen = snprintf(statusRight, sizeof(statusRight), "%s | %d/%d", 
+    int statusRightLen = snprintf(statusRight, sizeof(statusRight), "%s | byte %lld | %d/%d", 
         (editor.syntax)? editor.syntax->fileType : "no file type",
+        editorRowByteOffset(editor.cursorY) + editor.cursorX,
         editor.cursorY + 1, editor.rowAmt);
 
     if (statusLeftLen > editor.termCols) {
         statusLeftLen = editor.termCols;
     }
-    // Add the left portion of the status to the screen.
-    bufAppend(aBuf, statusLeft, statusLeftLen);
+    // Add the left portion of the status to the screen, with inverted colors.
+    screenLineAppend(screen, line, statusLeft, statusLeftLen, HL_NORMAL | CELL_INVERSE);
 
     while (statusLeftLen < editor.termCols) {
         // Add the right poriton of the status to the screen once we determine that 
         // we have enough space for the right portion.
         if (editor.termCols - statusLeftLen == statusRightLen) {
-            bufAppend(aBuf, statusRight, statusRightLen);
+            screenLineAppend(screen, line, statusRight, statusRightLen, HL_NORMAL | CELL_INVERSE);
             break;
         }
         // Add the margin between the left and right portions of the status 
         // to the screen.
         else {
-            bufAppend(aBuf, " ", 1);
+            screenLineAppend(screen, line, " ", 1, HL_NORMAL | CELL_INVERSE);
             statusLeftLen++;
         }
     }
-    // Reset terminal colors back to normal.
-    bufAppend(aBuf, "\x1b[m", 3);
-    bufAppend(aBuf, "\r\n", 2);
 }
 
-void editorDrawMessageBar(struct AppendBuf *aBuf) {
-    bufAppend(aBuf, "\x1b[K", 3);
+void editorDrawMessageBar(struct Screen *screen) {
+    struct ScreenLine *line = &screen->lines[editor.termRows + 1];
+    line->len = 0;
+
     int msgLen = strlen(editor.statusMsg);
     
     if (msgLen > editor.termCols) {
         msgLen = editor.termCols;
     }
-    if (msgLen && time(NULL) - editor.statusMsgTime < TERMINAL_EDITOR_STATUS_MSG_TIMEOUT) {
-        bufAppend(aBuf, editor.statusMsg, msgLen);
+    if (msgLen && (editor.prompting || editor.timers[TIMER_STATUS_MSG].armed)) {
+        screenLineAppend(screen, line, editor.statusMsg, msgLen, HL_NORMAL);
     }
 }
 
 void editorRefreshScreen() {
+    // Offsets of the last frame, to find out whether the rows scrolled.
+    static int lastRowOffset = 0;
+    static int lastColOffset = 0;
+
     editorScroll();
 
-    struct AppendBuf aBuf = NEW_APPEND_BUF;
+    if (editor.colOffset == lastColOffset) {
+        screenScroll(&editor.screen, 0, editor.termRows, editor.rowOffset - lastRowOffset);
+    }
+    lastRowOffset = editor.rowOffset;
+    lastColOffset = editor.colOffset;
 
-    hideCursor(&aBuf);
-    resetTermCursorBuf(&aBuf);
+    editorDrawRows(&editor.screen);
+    editorDrawStatusBar(&editor.screen);
+    editorDrawMessageBar(&editor.screen);
 
-    editorDrawRows(&aBuf);
-    editorDrawStatusBar(&aBuf);
-    editorDrawMessageBar(&aBuf);
+    // Only write out what changed since the last frame, leaving the cursor 
+    // at the position saved in the editor state.
+    struct AppendBuf *aBuf = &editor.screen.frame;
+    clearAppendBuf(aBuf);
+    screenFlush(&editor.screen, aBuf, editor.cursorY - editor.rowOffset, editor.renderCursorX - editor.colOffset);
 
-    // Move the cursor to be at the position saved in the editor state.
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (editor.cursorY - editor.rowOffset) + 1, (editor.renderCursorX - editor.colOffset) + 1);
-    bufAppend(&aBuf, buf, strlen(buf));
+    clock_gettime(CLOCK_MONOTONIC, &editor.screen.lastFrameTime);
 
-    showCursor(&aBuf);
+    if (aBuf->len > 0) {
+        write(STDOUT_FILENO, aBuf->buf, aBuf->len);
 
-    write(STDOUT_FILENO, aBuf.buf, aBuf.len);
-    freeAppendBuf(&aBuf);
+        editor.screen.lastFrameBytes = aBuf->len;
+        editor.screen.totalFrameBytes += aBuf->len;
+        editor.screen.frameAmt++;
+    }
+}
+
+// Draws a frame, unless the frame rate cap holds it back. A frame that is 
+// held back is drawn by TIMER_FRAME, with whatever happened in the meantime.
+void editorRequestFrame() {
+    struct Timer *timer = &editor.timers[TIMER_FRAME];
+#if TERMINAL_EDITOR_MAX_FPS > 0
+    long long wait = 1000 / TERMINAL_EDITOR_MAX_FPS - timerElapsedMs(&editor.screen.lastFrameTime);
+    if (wait > 0) {
+        if (timer->armed) {
+            editor.screen.skippedFrameAmt++;
+        }
+        else {
+            timerArm(TIMER_FRAME, wait);
+        }
+        return;
+    }
+#endif
+    timer->armed = false;
+    editorRefreshScreen();
+}
+
+// Draws the frame that the frame rate cap held back.
+bool editorFrameDue() {
+    return true;
+}
+
+// Reports how many bytes the last frames took to write to the terminal.
+void editorShowFrameStats() {
+    editorSetStatusMessage("Last frame: %zu bytes | %zu frames, %zu bytes avg | %zu not drawn",
+        editor.screen.lastFrameBytes,
+        editor.screen.frameAmt,
+        (editor.screen.frameAmt > 0)? editor.screen.totalFrameBytes / editor.screen.frameAmt : 0,
+        editor.screen.skippedFrameAmt);
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -1438,7 +7315,27 @@ void editorSetStatusMessage(const char *fmt, ...) {
     va_start(ap, fmt);
     vsnprintf(editor.statusMsg, sizeof(editor.statusMsg), fmt, ap);
     va_end(ap);
-    editor.statusMsgTime = time(NULL);
+    timerArm(TIMER_STATUS_MSG, TERMINAL_EDITOR_STATUS_MSG_TIMEOUT * 1000);
+}
+
+// Clears the status message off the screen once it expires.
+bool editorStatusMsgExpired() {
+    return editor.statusMsg[0] != '\0';
+}
+
+// Fits the screen to the new size of the terminal.
+void editorHandleResize() {
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) {
+        return;
+    }
+    // Always leave room for a row of text above the status rows.
+    if (rows < 3) {
+        rows = 3;
+    }
+    editor.termRows = rows - 2;
+    editor.termCols = cols;
+    screenResize(&editor.screen, rows, cols);
 }
 
 /*
@@ -1455,21 +7352,86 @@ void initEditor() {
     editor.colOffset = 0;
 
     editor.rowAmt = 0;
-    editor.rows = NULL;
+    editor.rowRoot = rowTreeNew();
     
     editor.filename = NULL;
 
+    editor.fileMap = NULL;
+    editor.fileMapSize = 0;
+
+    editor.load.active = false;
+    editor.load.fp = NULL;
+    editor.load.pending = NULL;
+    editor.load.pendingLen = 0;
+    editor.load.pendingCapacity = 0;
+
     editor.statusMsg[0] = '\0';
-    editor.statusMsgTime = 0;
+    editor.prompting = false;
+    editor.promptInfo[0] = '\0';
+
+    editor.search.active = false;
+    editor.search.query = NULL;
+    editor.search.pattern.text = NULL;
+    editor.search.pattern.regex = NULL;
+    editor.search.pattern.error = NULL;
+    editor.search.pattern.starts = NULL;
+    editor.search.pattern.ends = NULL;
+    editor.search.matches = NULL;
+    editor.search.matchAmt = 0;
+    editor.search.matchCapacity = 0;
+    editor.search.current = -1;
+    editor.search.highlightCurrent = false;
+    editor.search.batchDepth = 0;
+    editor.search.batchEdited = false;
+    editor.search.pool.threadAmt = 0;
+    editor.search.pool.generation = 0;
+    editor.search.pool.chunks = NULL;
+    editor.search.pool.chunkAmt = 0;
+    editor.search.pool.chunkCapacity = 0;
+    editor.search.pool.dispatchedAmt = 0;
+    editor.search.pool.doneAmt = 0;
+    editor.search.pool.canceled = false;
+
+    editor.undo = (struct UndoLog){ .text = NEW_APPEND_BUF };
+    editor.journal = (struct Journal){ .fd = -1, .path = NULL, .pending = NEW_APPEND_BUF };
 
     editor.syntax = NULL;
+    editor.syntaxStateEnd = 0;
+    editor.syntaxStateHighWater = 0;
+
+    editor.version = 0;
+    editor.savedVersion = 0;
+    editor.charsEpoch = 0;
+    editor.save = (struct SaveJob){ .active = false, .wakeFds = { -1, -1 } };
 
-    editor.isDirty = false;
+    editor.input.start = 0;
+    editor.input.len = 0;
+
+    editor.timers[TIMER_STATUS_MSG] = (struct Timer){ .armed = false, .callback = editorStatusMsgExpired };
+    editor.timers[TIMER_JOURNAL_SYNC] = (struct Timer){ .armed = false, .callback = journalSync };
+    editor.timers[TIMER_FRAME] = (struct Timer){ .armed = false, .callback = editorFrameDue };
+    watchWindowSize();
 
     if (getWindowSize(&editor.termRows, &editor.termCols) == -1) {
         die("getWindowSize");
     }
     editor.termRows -= 2; // make room for the status rows at the bottom
+
+    editor.screen.rows = 0;
+    editor.screen.lines = NULL;
+    editor.screen.shadow = NULL;
+    editor.screen.cursorRow = -1;
+    editor.screen.cursorCol = -1;
+    editor.screen.lastFrameBytes = 0;
+    editor.screen.totalFrameBytes = 0;
+    editor.screen.frameAmt = 0;
+    editor.screen.lastFrameTime = (struct timespec){ 0, 0 };
+    editor.screen.skippedFrameAmt = 0;
+    editor.screen.frame = (struct AppendBuf)NEW_APPEND_BUF;
+    editor.screen.scrollAmount = 0;
+    editor.screen.syncOutput = getSyncOutputSupport();
+    screenInitSgrTable(&editor.screen);
+    screenResize(&editor.screen, editor.termRows + 2, editor.termCols);
 }
 
 int main(int argc, char *argv[]) {
@@ -1483,10 +7445,34 @@ int main(int argc, char *argv[]) {
     editorSetStatusMessage("HELP: press CTRL-Q to quit or CTRL-S to save or CTRL-F to find");
 
     while (true) {
-        editorRefreshScreen();
+        editorRequestFrame();
+
+        // Keep loading the opened file in chunks while no keys are pressed, 
+        // redrawing the screen after each chunk to show the progress.
+        if (editor.load.active && !editorInputPending()) {
+            editorLoadStep();
+            continue;
+        }
+
+        // Catch up on the highlighting past the screen while no keys are pressed.
+        while (!editorInputPending() && editorSyntaxIdleStep()) {}
 
-        // Blocks until a keypress is read.
+        journalFlush(&editor.journal);
+
+        // Sleeps until there is something to do.
+        if (!editorWaitForInput()) {
+            continue;
+        }
         editorProcessKeypress();
+
+        // Apply the keys that are already waiting before drawing, instead of 
+        // drawing frames in between that would be replaced right away.
+        struct timespec batchStart;
+        clock_gettime(CLOCK_MONOTONIC, &batchStart);
+        while (editorInputPending() && timerElapsedMs(&batchStart) < TERMINAL_EDITOR_FRAME_COALESCE_MS) {
+            editor.screen.skippedFrameAmt++;
+            editorProcessKeypress();
+        }
     }
 
     return 0;